@@ -0,0 +1,211 @@
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "hash_store.h"
+#include "input.h"
+
+#define DEFAULT_SIZE_MB 1024
+#define DEFAULT_PATH "./bench_input.txt"
+
+// Segments of each file in the generated input.
+#define BENCH_SEGMENTS 100000
+
+using namespace std;
+
+
+/**
+ * Returns the time since an arbitrary point, in seconds.
+*/
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+
+/**
+ * Folds bytes into a checksum (FNV-1a). Every loader folds all its hashes, so the
+ * timing includes reading them: a mapping alone doesn't touch the pages.
+*/
+static uint64_t fold_bytes(uint64_t checksum, const unsigned char *bytes, size_t size) {
+    for (size_t k = 0; k < size; k++) {
+        checksum = (checksum ^ bytes[k]) * 0x100000001b3ULL;
+    }
+
+    return checksum;
+}
+
+
+/**
+ * Writes an input file of about size_mb megabytes, made of files of
+ * BENCH_SEGMENTS random hashes, and one requested file.
+*/
+static void generate_input(const char *path, long size_mb) {
+    long num_segments = size_mb * 1024 * 1024 / (DIGEST_HEX_SIZE + 1);
+    int num_files = (num_segments + BENCH_SEGMENTS - 1) / BENCH_SEGMENTS;
+
+    FILE *file = fopen(path, "w");
+    unsigned int seed = 1;
+
+    fprintf(file, "%d\n", num_files);
+
+    for (int i = 0; i < num_files; i++) {
+        long count = min((long) BENCH_SEGMENTS, num_segments - (long) i * BENCH_SEGMENTS);
+        fprintf(file, "file%d %ld\n", i + 1, count);
+
+        for (long j = 0; j < count; j++) {
+            fprintf(file, "%08x%08x%08x%08x\n", rand_r(&seed), rand_r(&seed), rand_r(&seed), rand_r(&seed));
+        }
+    }
+
+    fprintf(file, "1\nfile%d\n", num_files + 1);
+    fclose(file);
+}
+
+
+/**
+ * Reads the input like the old code: a std::string per hash, then the whole
+ * structure copied into the tuple and the thread arguments. Returns the
+ * checksum of the hex hashes.
+*/
+static uint64_t load_with_streams(const char *path) {
+    ifstream file(path);
+
+    int num_files;
+    file >> num_files;
+
+    vector<vector<string>> files;
+
+    for (int i = 0; i < num_files; i++) {
+        string file_name;
+        int num_segments;
+
+        file >> file_name >> num_segments;
+
+        int file_index = name_to_index(file_name);
+
+        if (file_index >= (int) files.size()) {
+            files.resize(file_index + 1);
+        }
+
+        for (int j = 0; j < num_segments; j++) {
+            string segment;
+
+            file >> segment;
+            files[file_index].push_back(segment);
+        }
+    }
+
+    vector<vector<string>> tuple_copy = files;
+    vector<vector<string>> argument_copy = tuple_copy;
+
+    uint64_t checksum = 0xcbf29ce484222325ULL;
+
+    for (auto& hashes : argument_copy) {
+        for (auto& hash : hashes) {
+            checksum = fold_bytes(checksum, (const unsigned char *) hash.data(), hash.size());
+        }
+    }
+
+    return checksum;
+}
+
+
+/**
+ * Reads the input with the mapped loader. Returns the checksum of the digests,
+ * the same for a text file and its binary version.
+*/
+static uint64_t load_with_mapping(const char *path) {
+    input_t input;
+    hash_store_t files;
+
+    if (!load_input(path, input, files)) {
+        fprintf(stderr, "Nu s-a putut citi fisierul %s\n", path);
+        exit(-1);
+    }
+
+    uint64_t checksum = 0xcbf29ce484222325ULL;
+
+    for (int i = 0; i < (int) files.files.size(); i++) {
+        for (int j = 0; j < num_stored_segments(files, i); j++) {
+            checksum = fold_bytes(checksum, segment_hash(files, i, j).bytes, DIGEST_SIZE);
+        }
+    }
+
+    unload_input(input);
+
+    return checksum;
+}
+
+
+/**
+ * Writes the binary version of a text input file.
+*/
+static void convert_to_binary(const char *path, const char *binary_path) {
+    input_t input;
+    hash_store_t files;
+
+    if (!load_input(path, input, files) || !write_binary_input(binary_path, input, files)) {
+        fprintf(stderr, "Nu s-a putut converti fisierul %s\n", path);
+        exit(-1);
+    }
+
+    unload_input(input);
+}
+
+
+/**
+ * Measures the startup cost of reading a large input file and every hash in it,
+ * with streams and copies compared to the mapping of the text file (whose hashes
+ * are still converted and copied to the arena) and of its binary version.
+ * The file is generated first, unless it exists, and converted next to it:
+ * ./bench_input [size in MB] [path]
+*/
+int main(int argc, char *argv[]) {
+    long size_mb = argc > 1 ? atol(argv[1]) : DEFAULT_SIZE_MB;
+    const char *path = argc > 2 ? argv[2] : DEFAULT_PATH;
+    string binary_path = string(path) + ".bin";
+
+    FILE *existing = fopen(path, "r");
+
+    if (existing != NULL) {
+        fclose(existing);
+    } else {
+        generate_input(path, size_mb);
+    }
+
+    // Also warms up the page cache, so all the loaders read from memory.
+    convert_to_binary(path, binary_path.c_str());
+    load_with_mapping(binary_path.c_str());
+
+    // The mappings go first: with a few GB of input the streams may run out of memory.
+    printf("%-10s %18s %10s\n", "loader", "checksum", "time (s)");
+
+    double start = now();
+    uint64_t binary_checksum = load_with_mapping(binary_path.c_str());
+    double binary_time = now() - start;
+
+    printf("%-10s %18" PRIx64 " %10.3f\n", "binary", binary_checksum, binary_time);
+
+    start = now();
+    uint64_t mapping_checksum = load_with_mapping(path);
+    double mapping_time = now() - start;
+
+    printf("%-10s %18" PRIx64 " %10.3f\n", "mapping", mapping_checksum, mapping_time);
+    fflush(stdout);
+
+    start = now();
+    uint64_t streams_checksum = load_with_streams(path);
+    double streams_time = now() - start;
+
+    printf("%-10s %18" PRIx64 " %10.3f\n", "streams", streams_checksum, streams_time);
+    printf("speedup %.2fx (mapping), %.2fx (binary)\n", streams_time / mapping_time, streams_time / binary_time);
+}
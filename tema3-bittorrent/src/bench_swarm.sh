@@ -0,0 +1,180 @@
+#!/bin/bash
+
+# Runs tema3 on swarms made by gen_swarm, for several numbers of clients, and
+# prints a line per run: the time to completion, the download throughput of the
+# peers (requested segments per second, until a peer's last output file was
+# written) and the messages each tag the trackers handled (from --stats). The
+# outputs are compared with the hashes of the files. The same arguments give
+# the same swarms, so runs before and after a change can be compared.
+#
+# ./bench_swarm.sh [--clients "<n> ..."] [--files <n>] [--segments <min> <max>]
+#     [--seeders <fraction>] [--requests uniform|all|zipf] [--want <p>]
+#     [--trackers <n>] [--runs <n>] [--seed <n>] [--timeout <s>] [-- <tema3 options>]
+
+cd "$(dirname "$0")" || exit 1
+
+src="$(pwd)"
+
+clients="2 4 8"
+files=8
+min_segments=1000
+max_segments=5000
+seeders=0
+requests=uniform
+want=0.5
+trackers=1
+runs=3
+seed=1
+run_timeout=300
+tema3_args=()
+
+while [[ $# -gt 0 ]]; do
+    case $1 in
+        --clients)
+            shift
+            clients="$1"
+        ;;
+        --files)
+            shift
+            files="$1"
+        ;;
+        --segments)
+            min_segments="$2"
+            max_segments="$3"
+            shift 2
+        ;;
+        --seeders)
+            shift
+            seeders="$1"
+        ;;
+        --requests)
+            shift
+            requests="$1"
+        ;;
+        --want)
+            shift
+            want="$1"
+        ;;
+        --trackers)
+            shift
+            trackers="$1"
+        ;;
+        --runs)
+            shift
+            runs="$1"
+        ;;
+        --seed)
+            shift
+            seed="$1"
+        ;;
+        --timeout)
+            shift
+            run_timeout="$1"
+        ;;
+        --)
+            shift
+            tema3_args=("$@")
+            break
+        ;;
+        *)
+            echo "Optiune necunoscuta: $1"
+            exit 1
+        ;;
+    esac
+    shift
+done
+
+# Binary outputs can't be compared with the hex hashes.
+verify=1
+
+for arg in "${tema3_args[@]}"; do
+    if [ "$arg" == "--binary-output" ]; then
+        verify=0
+    fi
+done
+
+make build >/dev/null && make bench >/dev/null || exit 1
+
+work="$(mktemp -d)"
+trap 'rm -rf "$work"' EXIT
+
+printf "%-8s %-4s %9s %12s %12s %9s %9s %9s %9s  %s\n" \
+       "clients" "run" "time (s)" "min seg/s" "mean seg/s" "tag 3" "tag 6" "tag 7" "tag 8" "result"
+
+for n in $clients; do
+    for run in $(seq 1 "$runs"); do
+        rm -rf "${work:?}"/*
+
+        (cd "$work" && "$src/gen_swarm" "$n" "$files" "$min_segments" "$max_segments" --trackers "$trackers" \
+            --seeders "$seeders" --requests "$requests" --want "$want" --seed "$seed") || exit 1
+
+        start=$(date +%s.%N)
+
+        (cd "$work" && timeout "$run_timeout" mpirun --oversubscribe -np $((trackers + n)) "$src/tema3" \
+            --trackers "$trackers" --stats stats "${tema3_args[@]}" > tema3.log 2>&1)
+        status=$?
+
+        end=$(date +%s.%N)
+
+        result="ok"
+
+        if [ $status == 124 ]; then
+            result="timeout"
+        elif [ $status != 0 ]; then
+            result="error $status"
+        fi
+
+        # Throughput of each client that requested something, up to its last write.
+        rates=()
+
+        while read -r rank num_wanted wanted_segments; do
+            if [ "$num_wanted" == 0 ]; then
+                continue
+            fi
+
+            last=$(find "$work" -maxdepth 1 -name "client${rank}_file*" ! -name "*.progress" -printf '%T@\n' | sort -n | tail -1)
+
+            if [ -z "$last" ]; then
+                result="missing"
+                continue
+            fi
+
+            rates+=("$(echo "$wanted_segments $start $last" | awk '{ printf "%.0f", $1 / ($3 - $2) }')")
+
+            if [ $verify == 1 ]; then
+                for output in $(find "$work" -maxdepth 1 -name "client${rank}_file*" ! -name "*.progress" -printf '%f\n'); do
+                    if ! diff -q -w "$work/$output" "$work/out${output#client${rank}_file}.txt" >/dev/null; then
+                        result="wrong $output"
+                    fi
+                done
+
+                if [ "$(find "$work" -maxdepth 1 -name "client${rank}_file*" ! -name "*.progress" | wc -l)" != "$num_wanted" ]; then
+                    result="missing"
+                fi
+            fi
+        done < "$work/wants.txt"
+
+        min_rate=$(printf "%s\n" "${rates[@]}" | sort -n | head -1)
+        mean_rate=$(printf "%s\n" "${rates[@]}" | awk '{ sum += $1 } END { if (NR > 0) printf "%.0f", sum / NR }')
+
+        # Messages handled by all the trackers, for each tag.
+        counts=()
+
+        for tag in 3 6 7 8; do
+            count=0
+
+            for t in $(seq 0 $((trackers - 1))); do
+                if [ -f "$work/stats$t.json" ]; then
+                    tag_count=$(grep -o "\"$tag\": {\"count\": [0-9]*" "$work/stats$t.json" | head -1 | grep -o "[0-9]*$")
+                    count=$((count + ${tag_count:-0}))
+                fi
+            done
+
+            counts+=("$count")
+        done
+
+        printf "%-8s %-4s %9.3f %12s %12s %9s %9s %9s %9s  %s\n" \
+               "$n" "$run" "$(echo "$start $end" | awk '{ print $2 - $1 }')" "${min_rate:--}" "${mean_rate:--}" \
+               "${counts[@]}" "$result"
+    done
+done
@@ -0,0 +1,70 @@
+#include "bitset.h"
+
+
+/**
+ * Checks if the bit at index is set.
+*/
+bool test_bit(const bitset_word_t *words, int index) {
+    return (words[index / BITS_PER_WORD] >> (index % BITS_PER_WORD)) & 1;
+}
+
+
+/**
+ * Sets the bit at index.
+*/
+void set_bit(bitset_word_t *words, int index) {
+    words[index / BITS_PER_WORD] |= (bitset_word_t) 1 << (index % BITS_PER_WORD);
+}
+
+
+/**
+ * Clears the bit at index.
+*/
+void clear_bit(bitset_word_t *words, int index) {
+    words[index / BITS_PER_WORD] &= ~((bitset_word_t) 1 << (index % BITS_PER_WORD));
+}
+
+
+/**
+ * Sets bits 0 .. num_bits-1, a whole word at a time.
+*/
+void set_first_bits(bitset_word_t *words, int num_bits) {
+    int full_words = num_bits / BITS_PER_WORD;
+    int remaining = num_bits % BITS_PER_WORD;
+
+    for (int i = 0; i < full_words; i++) {
+        words[i] = ~(bitset_word_t) 0;
+    }
+
+    if (remaining != 0) {
+        words[full_words] |= ((bitset_word_t) 1 << remaining) - 1;
+    }
+}
+
+
+/**
+ * Counts the set bits.
+*/
+int count_bits(const bitset_word_t *words, int num_words) {
+    int count = 0;
+
+    for (int i = 0; i < num_words; i++) {
+        count += __builtin_popcountll(words[i]);
+    }
+
+    return count;
+}
+
+
+/**
+ * Returns the index of the first set bit, or -1 if there is none.
+*/
+int find_first_set(const bitset_word_t *words, int num_words) {
+    for (int i = 0; i < num_words; i++) {
+        if (words[i] != 0) {
+            return i * BITS_PER_WORD + __builtin_ctzll(words[i]);
+        }
+    }
+
+    return -1;
+}
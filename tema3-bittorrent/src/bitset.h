@@ -0,0 +1,20 @@
+#ifndef BITSET_H
+#define BITSET_H
+
+#include <stdint.h>
+
+#define BITS_PER_WORD 64
+
+// Number of words needed to store num_bits bits.
+#define BITSET_WORDS(num_bits) (((num_bits) + BITS_PER_WORD - 1) / BITS_PER_WORD)
+
+typedef uint64_t bitset_word_t;
+
+bool test_bit(const bitset_word_t *words, int index);
+void set_bit(bitset_word_t *words, int index);
+void clear_bit(bitset_word_t *words, int index);
+void set_first_bits(bitset_word_t *words, int num_bits);
+int count_bits(const bitset_word_t *words, int num_words);
+int find_first_set(const bitset_word_t *words, int num_words);
+
+#endif
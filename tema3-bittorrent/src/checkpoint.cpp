@@ -0,0 +1,107 @@
+#include "checkpoint.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "input.h"
+
+using namespace std;
+
+
+/**
+ * Returns the name of the output file of a client.
+*/
+string output_file_name(int rank, int file_index) {
+    return "client" + to_string(rank) + "_" + index_to_name(file_index);
+}
+
+
+/**
+ * Returns the name of the progress file of a client, next to the output file.
+*/
+string checkpoint_file_name(int rank, int file_index) {
+    return output_file_name(rank, file_index) + ".progress";
+}
+
+
+/**
+ * Reads the hashes of the segments set in have from the output file into the slots of the file.
+*/
+static bool read_saved_hashes(int fd, bool binary, hash_store_t& files, int file_index, const vector<bitset_word_t>& have) {
+    size_t record_size = binary ? sizeof(digest_t) : DIGEST_HEX_SIZE + 1;
+    char record[DIGEST_HEX_SIZE + 1];
+
+    for (int w = 0; w < (int) have.size(); w++) {
+        for (bitset_word_t word = have[w]; word != 0; word &= word - 1) {
+            int segment = w * BITS_PER_WORD + __builtin_ctzll(word);
+            digest_t& slot = segment_slot(files, file_index, segment);
+
+            if (pread(fd, record, record_size, (off_t) segment * record_size) != (ssize_t) record_size) {
+                return false;
+            }
+
+            if (binary) {
+                memcpy(&slot, record, sizeof(digest_t));
+            } else if (!digest_from_hex(record, DIGEST_HEX_SIZE, &slot)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * Loads the progress of a previous run on a file: the have bitset, and the hashes
+ * it marks, read from the output file into new slots, and the size and fingerprint
+ * of the file it was made for. Returns false if there is no usable checkpoint
+ * (missing, written with the other output format or an older version, or damaged).
+ * Whether it is of the same file is only known once the swarm's sizes arrive.
+*/
+bool load_checkpoint(int rank, int file_index, bool binary, hash_store_t& files, vector<bitset_word_t>& have,
+                     int *num_segments, uint64_t *fingerprint) {
+    int fd = open(checkpoint_file_name(rank, file_index).c_str(), O_RDONLY);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    int32_t header[CHECKPOINT_HEADER_SIZE];
+    bool valid = read(fd, header, sizeof(header)) == sizeof(header) && header[0] == CHECKPOINT_MAGIC &&
+                 header[1] > 0 && header[2] == (binary ? 1 : 0);
+
+    if (valid) {
+        *num_segments = header[1];
+        *fingerprint = (uint64_t) (uint32_t) header[3] | (uint64_t) (uint32_t) header[4] << 32;
+        have.assign(BITSET_WORDS(*num_segments), 0);
+
+        size_t size = have.size() * sizeof(bitset_word_t);
+        valid = read(fd, &have[0], size) == (ssize_t) size;
+
+        // Bits past the last segment are ignored.
+        if (*num_segments % BITS_PER_WORD != 0) {
+            have.back() &= ((bitset_word_t) 1 << (*num_segments % BITS_PER_WORD)) - 1;
+        }
+    }
+
+    close(fd);
+
+    if (!valid) {
+        return false;
+    }
+
+    fd = open(output_file_name(rank, file_index).c_str(), O_RDONLY);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    add_file(files, file_index, *num_segments);
+    valid = read_saved_hashes(fd, binary, files, file_index, have);
+
+    close(fd);
+
+    return valid;
+}
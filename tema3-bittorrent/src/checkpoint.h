@@ -0,0 +1,26 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "bitset.h"
+#include "hash_store.h"
+
+// Progress of the download of a file, kept next to its output file so that a
+// restarted client only fetches the missing segments. The hashes themselves are
+// in the output file, at their offsets. The progress file holds a header of
+// CHECKPOINT_HEADER_SIZE 32-bit ints (CHECKPOINT_MAGIC, number of segments, 1 if
+// the output is binary, the fingerprint of the file in two halves, low first),
+// then the have bitset, rewritten one word at a time as segments arrive. A
+// checkpoint is only used for a file of the same size and fingerprint.
+#define CHECKPOINT_MAGIC 0x50433354
+#define CHECKPOINT_HEADER_SIZE 5
+
+std::string output_file_name(int rank, int file_index);
+std::string checkpoint_file_name(int rank, int file_index);
+bool load_checkpoint(int rank, int file_index, bool binary, hash_store_t& files, std::vector<bitset_word_t>& have,
+                     int *num_segments, uint64_t *fingerprint);
+
+#endif
@@ -0,0 +1,165 @@
+#include "config.h"
+#include "messages.h"
+#include "output_writer.h"
+#include "piece_picker.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+config_t config = {
+    DEFAULT_WINDOW_SIZE,
+    DEFAULT_UPLOAD_THREADS,
+    DEFAULT_UPLOAD_QUEUE_SIZE,
+    DEFAULT_PICKER,
+    false,
+    DEFAULT_HAVE_BATCH_SIZE,
+    DEFAULT_HAVE_INTERVAL,
+    DEFAULT_NUM_TRACKERS,
+    false,
+    DEFAULT_REQUEST_BATCH,
+    DEFAULT_FSYNC,
+    DEFAULT_SWARM_REFRESH,
+    true,
+    DEFAULT_DOWNLOAD_THREADS,
+    DEFAULT_GOSSIP,
+    false,
+    NULL,
+    DEFAULT_ENDGAME,
+};
+
+
+/**
+ * Reads a strictly positive integer option value.
+*/
+static bool parse_positive(const char *value, int *result) {
+    char *end;
+    long number = strtol(value, &end, 10);
+
+    if (*value == '\0' || *end != '\0' || number <= 0) {
+        return false;
+    }
+
+    *result = number;
+    return true;
+}
+
+
+/**
+ * Reads a positive or zero integer option value.
+*/
+static bool parse_non_negative(const char *value, int *result) {
+    if (strcmp(value, "0") == 0) {
+        *result = 0;
+        return true;
+    }
+
+    return parse_positive(value, result);
+}
+
+
+/**
+ * Reads the options from the command line into config. Returns false on an invalid option.
+*/
+bool parse_config(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--window") == 0 && i + 1 < argc) {
+            if (!parse_positive(argv[++i], &config.window_size)) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--download-threads") == 0 && i + 1 < argc) {
+            if (!parse_positive(argv[++i], &config.download_threads)) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--upload-threads") == 0 && i + 1 < argc) {
+            if (!parse_positive(argv[++i], &config.upload_threads)) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--upload-queue") == 0 && i + 1 < argc) {
+            if (!parse_positive(argv[++i], &config.upload_queue_size)) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--picker") == 0 && i + 1 < argc) {
+            config.picker = argv[++i];
+
+            if (find_piece_picker(config.picker) == NULL) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--two-choices") == 0) {
+            config.two_choices = true;
+        } else if (strcmp(argv[i], "--have-batch") == 0 && i + 1 < argc) {
+            if (!parse_positive(argv[++i], &config.have_batch_size)) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--have-interval") == 0 && i + 1 < argc) {
+            if (!parse_non_negative(argv[++i], &config.have_interval)) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--trackers") == 0 && i + 1 < argc) {
+            if (!parse_positive(argv[++i], &config.num_trackers)) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--request-batch") == 0 && i + 1 < argc) {
+            if (!parse_positive(argv[++i], &config.request_batch) || config.request_batch > MAX_REQUEST_BATCH) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--fsync") == 0 && i + 1 < argc) {
+            config.fsync = argv[++i];
+
+            if (find_fsync_policy(config.fsync) == -1) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--swarm-refresh") == 0 && i + 1 < argc) {
+            if (!parse_non_negative(argv[++i], &config.swarm_refresh)) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--no-invalidations") == 0) {
+            config.invalidations = false;
+        } else if (strcmp(argv[i], "--gossip") == 0 && i + 1 < argc) {
+            if (!parse_non_negative(argv[++i], &config.gossip)) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--endgame") == 0 && i + 1 < argc) {
+            if (!parse_non_negative(argv[++i], &config.endgame)) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--rma") == 0) {
+            config.rma = true;
+        } else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+            config.stats = argv[++i];
+        } else if (strcmp(argv[i], "--binary-output") == 0) {
+            config.binary_output = true;
+        } else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * Prints the accepted options.
+*/
+void print_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [options]\n", program);
+    fprintf(stderr, "  --window <n>            segment requests kept in flight (default %d)\n", DEFAULT_WINDOW_SIZE);
+    fprintf(stderr, "  --download-threads <n>  threads sending segment requests (default %d)\n", DEFAULT_DOWNLOAD_THREADS);
+    fprintf(stderr, "  --upload-threads <n>    threads sending hashes (default %d)\n", DEFAULT_UPLOAD_THREADS);
+    fprintf(stderr, "  --upload-queue <n>      capacity of the upload request queue (default %d)\n", DEFAULT_UPLOAD_QUEUE_SIZE);
+    fprintf(stderr, "  --picker <name>         segment order: rarest, random or sequential (default %s)\n", DEFAULT_PICKER);
+    fprintf(stderr, "  --two-choices           pick the better of two random peers instead of the best one\n");
+    fprintf(stderr, "  --have-batch <n>        downloaded segments reported to the tracker at once (default %d)\n", DEFAULT_HAVE_BATCH_SIZE);
+    fprintf(stderr, "  --have-interval <ms>    longest wait before reporting a segment, 0 for none (default %d)\n", DEFAULT_HAVE_INTERVAL);
+    fprintf(stderr, "  --trackers <n>          tracker ranks, fewer than the processes (default %d)\n", DEFAULT_NUM_TRACKERS);
+    fprintf(stderr, "  --request-batch <n>     segments asked from a peer in one request, at most %d (default %d)\n", MAX_REQUEST_BATCH, DEFAULT_REQUEST_BATCH);
+    fprintf(stderr, "  --fsync <policy>        flush the output files: none, file or always (default %s),\n"
+                    "                          with none a resume is only safe after the process dies\n", DEFAULT_FSYNC);
+    fprintf(stderr, "  --swarm-refresh <ms>    longest use of a cached swarm view, 0 for none (default %d)\n", DEFAULT_SWARM_REFRESH);
+    fprintf(stderr, "  --no-invalidations      don't let the trackers announce swarm changes, only refresh on time\n");
+    fprintf(stderr, "  --gossip <k>            exchange have-bitmaps with the clients at distance 1, 2, ..., 2^(k-1)\n");
+    fprintf(stderr, "                          instead of asking the trackers, 0 for the trackers (default %d)\n", DEFAULT_GOSSIP);
+    fprintf(stderr, "  --endgame <n>           ask a second peer for the last n missing segments of a file, 0 for none (default %d)\n", DEFAULT_ENDGAME);
+    fprintf(stderr, "  --rma                   read the hashes from the other clients' memory with MPI_Rget\n");
+    fprintf(stderr, "  --stats <prefix>        write message counts and latencies to <prefix><rank>.json at exit and on SIGUSR1\n");
+    fprintf(stderr, "  --binary-output         write the downloaded hashes as binary digests instead of hex lines\n");
+}
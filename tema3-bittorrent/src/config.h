@@ -0,0 +1,72 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+// Maximum number of segment requests a peer keeps in flight.
+#define DEFAULT_WINDOW_SIZE 8
+
+// Threads that send the segment requests and store the hashes that arrive.
+#define DEFAULT_DOWNLOAD_THREADS 1
+
+// Threads that send hashes to the other peers.
+#define DEFAULT_UPLOAD_THREADS 2
+
+// Capacity of the queue between the upload receiver and the senders.
+#define DEFAULT_UPLOAD_QUEUE_SIZE 64
+
+// Order in which segments are requested, one of the pickers in piece_picker.cpp.
+#define DEFAULT_PICKER "rarest"
+
+// Downloaded segments reported to the tracker in one message, and the longest
+// time a downloaded segment waits to be reported, in milliseconds (0 to disable).
+#define DEFAULT_HAVE_BATCH_SIZE 10
+#define DEFAULT_HAVE_INTERVAL 50
+
+// Segments asked from a peer in one request, at most MAX_REQUEST_BATCH.
+#define DEFAULT_REQUEST_BATCH 16
+
+// When the output files are flushed to disk, one of the policies in output_writer.h.
+#define DEFAULT_FSYNC "file"
+
+// Longest time a client uses its cached view of a swarm before asking the tracker
+// again, in milliseconds (0 to ask before every refill of the window).
+#define DEFAULT_SWARM_REFRESH 100
+
+// Distances of the neighbours a client exchanges have-bitmaps with, instead of
+// asking the trackers for the swarms (0 to use the trackers).
+#define DEFAULT_GOSSIP 0
+
+// A file enters the endgame once at most this many of its segments are missing:
+// the outstanding ones are also asked from a second peer (0 to disable).
+#define DEFAULT_ENDGAME 32
+
+// Number of tracker ranks the files are split between.
+#define DEFAULT_NUM_TRACKERS 1
+
+// Runtime options, the same for all the ranks (they all get the same command line).
+typedef struct {
+    int window_size;
+    int upload_threads;
+    int upload_queue_size;
+    const char *picker;
+    bool two_choices;
+    int have_batch_size;
+    int have_interval;
+    int num_trackers;
+    bool binary_output;
+    int request_batch;
+    const char *fsync;
+    int swarm_refresh;
+    bool invalidations;
+    int download_threads;
+    int gossip;
+    bool rma;
+    const char *stats;
+    int endgame;
+} config_t;
+
+extern config_t config;
+
+bool parse_config(int argc, char *argv[]);
+void print_usage(const char *program);
+
+#endif
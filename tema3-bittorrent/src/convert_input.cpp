@@ -0,0 +1,33 @@
+#include <stdio.h>
+
+#include "hash_store.h"
+#include "input.h"
+
+
+/**
+ * Converts a text input file to the binary format, which the peers load
+ * without converting the hashes: ./convert_input in1.txt in1.bin
+*/
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <text input> <binary input>\n", argv[0]);
+        return -1;
+    }
+
+    input_t input;
+    hash_store_t files;
+
+    if (!load_input(argv[1], input, files)) {
+        fprintf(stderr, "Nu s-a putut citi fisierul %s\n", argv[1]);
+        return -1;
+    }
+
+    if (!write_binary_input(argv[2], input, files)) {
+        fprintf(stderr, "Nu s-a putut scrie fisierul %s\n", argv[2]);
+        return -1;
+    }
+
+    unload_input(input);
+
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include "digest.h"
+#include <ctype.h>
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+
+typedef struct {
+    signed char values[256];
+} hex_table_t;
+
+
+/**
+ * Builds the table of hex digit values, -1 for the characters that aren't digits.
+*/
+static hex_table_t create_hex_table() {
+    hex_table_t table;
+
+    for (int c = 0; c < 256; c++) {
+        table.values[c] = -1;
+    }
+
+    for (int v = 0; v < 16; v++) {
+        table.values[(unsigned char) HEX_DIGITS[v]] = v;
+        table.values[toupper(HEX_DIGITS[v])] = v;
+    }
+
+    return table;
+}
+
+// Built before main, so the threads only read it.
+static const hex_table_t HEX_TABLE = create_hex_table();
+
+
+/**
+ * Reads a digest from DIGEST_HEX_SIZE hex characters. Returns false if
+ * there are more or fewer characters, or one of them isn't a hex digit.
+*/
+bool digest_from_hex(const char *hex, size_t length, digest_t *digest) {
+    if (length != DIGEST_HEX_SIZE) {
+        return false;
+    }
+
+    for (int i = 0; i < DIGEST_SIZE; i++) {
+        int high = HEX_TABLE.values[(unsigned char) hex[2 * i]];
+        int low = HEX_TABLE.values[(unsigned char) hex[2 * i + 1]];
+
+        if (high < 0 || low < 0) {
+            return false;
+        }
+
+        digest->bytes[i] = high << 4 | low;
+    }
+
+    return true;
+}
+
+
+/**
+ * Writes a digest as DIGEST_HEX_SIZE lowercase hex characters, without a terminator.
+*/
+void digest_to_hex(const digest_t& digest, char *hex) {
+    for (int i = 0; i < DIGEST_SIZE; i++) {
+        hex[2 * i] = HEX_DIGITS[digest.bytes[i] >> 4];
+        hex[2 * i + 1] = HEX_DIGITS[digest.bytes[i] & 0xf];
+    }
+}
@@ -0,0 +1,19 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <stddef.h>
+
+// A segment hash is kept and sent as DIGEST_SIZE bytes. The input and output
+// files have it as DIGEST_HEX_SIZE hex characters, converted only when reading
+// and writing them.
+#define DIGEST_SIZE 16
+#define DIGEST_HEX_SIZE (2 * DIGEST_SIZE)
+
+typedef struct {
+    unsigned char bytes[DIGEST_SIZE];
+} digest_t;
+
+bool digest_from_hex(const char *hex, size_t length, digest_t *digest);
+void digest_to_hex(const digest_t& digest, char *hex);
+
+#endif
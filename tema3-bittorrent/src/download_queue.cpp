@@ -0,0 +1,242 @@
+#include "download_queue.h"
+#include <errno.h>
+#include <time.h>
+
+using namespace std;
+
+
+/**
+ * Creates a queue for num_workers workers.
+*/
+download_queue_t *create_download_queue(int num_workers) {
+    download_queue_t *queue = new download_queue_t;
+    queue->num_workers = num_workers;
+    queue->tasks.resize(num_workers);
+    queue->task_mutexes.resize(num_workers);
+    queue->waiting = vector<atomic<bool>>(num_workers);
+    queue->wake_requests.assign(num_workers, MPI_REQUEST_NULL);
+
+    for (int i = 0; i < num_workers; i++) {
+        pthread_mutex_init(&queue->task_mutexes[i], NULL);
+        queue->waiting[i].store(false);
+    }
+
+    sem_init(&queue->num_tasks, 0, 0);
+
+    pthread_mutex_init(&queue->result_mutex, NULL);
+    pthread_cond_init(&queue->result_ready, NULL);
+
+    return queue;
+}
+
+
+/**
+ * Frees a queue created by create_download_queue().
+*/
+void destroy_download_queue(download_queue_t *queue) {
+    for (int i = 0; i < queue->num_workers; i++) {
+        pthread_mutex_destroy(&queue->task_mutexes[i]);
+    }
+
+    sem_destroy(&queue->num_tasks);
+    pthread_mutex_destroy(&queue->result_mutex);
+    pthread_cond_destroy(&queue->result_ready);
+
+    delete queue;
+}
+
+
+/**
+ * Adds a task to the deque of a worker, and wakes a worker waiting for its replies,
+ * the owner of the deque first. Any other may steal the task.
+*/
+void push_task(download_queue_t *queue, int worker, const download_task_t& task) {
+    pthread_mutex_lock(&queue->task_mutexes[worker]);
+    queue->tasks[worker].push_back(task);
+    pthread_mutex_unlock(&queue->task_mutexes[worker]);
+
+    sem_post(&queue->num_tasks);
+
+    // Pairs with the fence in start_wake_request(): either the worker sees the task,
+    // or this sees the worker waiting.
+    atomic_thread_fence(memory_order_seq_cst);
+
+    for (int k = 0; k < queue->num_workers; k++) {
+        int w = (worker + k) % queue->num_workers;
+
+        if (queue->waiting[w].load() && queue->waiting[w].exchange(false)) {
+            MPI_Grequest_complete(queue->wake_requests[w]);
+            break;
+        }
+    }
+}
+
+
+/**
+ * Takes a task reserved with the semaphore: the first one of the worker's own
+ * deque, or else the last one of another deque. The reservation guarantees one
+ * is left for this worker, it may only have to look again if another took first.
+*/
+static download_task_t take_reserved_task(download_queue_t *queue, int worker) {
+    while (true) {
+        for (int k = 0; k < queue->num_workers; k++) {
+            int victim = (worker + k) % queue->num_workers;
+            deque<download_task_t>& tasks = queue->tasks[victim];
+
+            pthread_mutex_lock(&queue->task_mutexes[victim]);
+
+            if (!tasks.empty()) {
+                download_task_t task;
+
+                if (victim == worker) {
+                    task = tasks.front();
+                    tasks.pop_front();
+                } else {
+                    task = tasks.back();
+                    tasks.pop_back();
+                }
+
+                pthread_mutex_unlock(&queue->task_mutexes[victim]);
+                return task;
+            }
+
+            pthread_mutex_unlock(&queue->task_mutexes[victim]);
+        }
+    }
+}
+
+
+/**
+ * Takes a task for a worker, if there is any. Returns false if the queue is empty.
+*/
+bool try_pop_task(download_queue_t *queue, int worker, download_task_t& task) {
+    if (sem_trywait(&queue->num_tasks) != 0) {
+        return false;
+    }
+
+    task = take_reserved_task(queue, worker);
+    return true;
+}
+
+
+/**
+ * Takes a task for a worker, waiting for one if the queue is empty.
+*/
+download_task_t pop_task(download_queue_t *queue, int worker) {
+    while (sem_wait(&queue->num_tasks) != 0 && errno == EINTR) {
+    }
+
+    return take_reserved_task(queue, worker);
+}
+
+
+/**
+ * Returns the result of a task to the download thread.
+*/
+void push_result(download_queue_t *queue, const download_result_t& result) {
+    pthread_mutex_lock(&queue->result_mutex);
+    queue->results.push_back(result);
+    pthread_cond_signal(&queue->result_ready);
+    pthread_mutex_unlock(&queue->result_mutex);
+}
+
+
+/**
+ * Moves the results returned so far into results, waiting for at least one for
+ * at most timeout seconds (or without a limit if timeout is negative).
+*/
+void take_results(download_queue_t *queue, vector<download_result_t>& results, double timeout) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+
+    if (timeout > 0) {
+        long nanoseconds = deadline.tv_nsec + (long) ((timeout - (long) timeout) * 1e9);
+        deadline.tv_sec += (long) timeout + nanoseconds / 1000000000;
+        deadline.tv_nsec = nanoseconds % 1000000000;
+    }
+
+    pthread_mutex_lock(&queue->result_mutex);
+
+    while (queue->results.empty() && timeout != 0) {
+        if (timeout < 0) {
+            pthread_cond_wait(&queue->result_ready, &queue->result_mutex);
+        } else if (pthread_cond_timedwait(&queue->result_ready, &queue->result_mutex, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+
+    results.assign(queue->results.begin(), queue->results.end());
+    queue->results.clear();
+
+    pthread_mutex_unlock(&queue->result_mutex);
+}
+
+
+/**
+ * Status of a completed wake request, which carries no data.
+*/
+static int wake_query(void *extra_state, MPI_Status *status) {
+    MPI_Status_set_elements(status, MPI_BYTE, 0);
+    MPI_Status_set_cancelled(status, 0);
+    status->MPI_SOURCE = MPI_UNDEFINED;
+    status->MPI_TAG = MPI_UNDEFINED;
+
+    return MPI_SUCCESS;
+}
+
+
+/**
+ * Frees a wake request, it has no state.
+*/
+static int wake_free(void *extra_state) {
+    return MPI_SUCCESS;
+}
+
+
+/**
+ * Cancels a wake request, it is always completed instead.
+*/
+static int wake_cancel(void *extra_state, int complete) {
+    return MPI_SUCCESS;
+}
+
+
+/**
+ * Starts the wake request of a worker about to block on its replies, to wait on
+ * with them. Returns false, without a request, if tasks are queued already.
+*/
+bool start_wake_request(download_queue_t *queue, int worker, MPI_Request *request) {
+    MPI_Grequest_start(wake_query, wake_free, wake_cancel, NULL, request);
+
+    queue->wake_requests[worker] = *request;
+    queue->waiting[worker].store(true);
+
+    atomic_thread_fence(memory_order_seq_cst);
+
+    int num_queued;
+    sem_getvalue(&queue->num_tasks, &num_queued);
+
+    if (num_queued > 0) {
+        finish_wake_request(queue, worker, request);
+        return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * Ends the wait of a worker. A wake request that is still pending is completed
+ * here, unless push_task() is already completing it, then freed.
+*/
+void finish_wake_request(download_queue_t *queue, int worker, MPI_Request *request) {
+    if (*request == MPI_REQUEST_NULL) {
+        return;
+    }
+
+    if (queue->waiting[worker].exchange(false)) {
+        MPI_Grequest_complete(*request);
+    }
+
+    MPI_Wait(request, MPI_STATUS_IGNORE);
+}
@@ -0,0 +1,66 @@
+#ifndef DOWNLOAD_QUEUE_H
+#define DOWNLOAD_QUEUE_H
+
+#include <mpi.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <vector>
+
+// A batch of segments of a file to ask from a peer, chosen by the download thread
+// and sent by a download worker. A client_rank of -1 stops the worker that takes it.
+typedef struct {
+    int client_rank;
+    int file_index;
+    int segment_index;
+    uint64_t segments;
+} download_task_t;
+
+// The outcome of a task, returned by the worker once the hashes are stored: the
+// segments of the task (requested), the ones whose hashes came first from the
+// client with index client (segments), and the round-trip time. In the endgame,
+// a task whose segments all came with other tasks is never sent (rtt -1).
+typedef struct {
+    int client;
+    int file_index;
+    int segment_index;
+    uint64_t requested;
+    uint64_t segments;
+    double rtt;
+} download_result_t;
+
+// Work-stealing queue between the download thread and the workers, one deque per
+// worker. A worker takes tasks from the front of its own deque and, when it is
+// empty, steals from the back of the others, so the tasks of a file stay with one
+// worker while it keeps up. Each deque has its own lock; the semaphore counts the
+// queued tasks so that idle workers can sleep. The results go back in a single list.
+// A worker with requests in flight and room for more blocks in MPI_Waitsome on its
+// replies and on wake_requests[worker], a generalized request that push_task()
+// completes while waiting[worker] is set, so a new task also ends the wait.
+typedef struct {
+    int num_workers;
+    std::vector<std::deque<download_task_t>> tasks;
+    std::vector<pthread_mutex_t> task_mutexes;
+    sem_t num_tasks;
+
+    std::vector<std::atomic<bool>> waiting;
+    std::vector<MPI_Request> wake_requests;
+
+    std::deque<download_result_t> results;
+    pthread_mutex_t result_mutex;
+    pthread_cond_t result_ready;
+} download_queue_t;
+
+download_queue_t *create_download_queue(int num_workers);
+void destroy_download_queue(download_queue_t *queue);
+void push_task(download_queue_t *queue, int worker, const download_task_t& task);
+bool try_pop_task(download_queue_t *queue, int worker, download_task_t& task);
+download_task_t pop_task(download_queue_t *queue, int worker);
+bool start_wake_request(download_queue_t *queue, int worker, MPI_Request *request);
+void finish_wake_request(download_queue_t *queue, int worker, MPI_Request *request);
+void push_result(download_queue_t *queue, const download_result_t& result);
+void take_results(download_queue_t *queue, std::vector<download_result_t>& results, double timeout);
+
+#endif
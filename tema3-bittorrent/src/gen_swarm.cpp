@@ -0,0 +1,285 @@
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Distribution of the requests, one of the patterns in request_pattern().
+#define PATTERN_UNIFORM 0
+#define PATTERN_ALL 1
+#define PATTERN_ZIPF 2
+
+#define DEFAULT_TRACKERS 1
+#define DEFAULT_SEEDERS 0.0
+#define DEFAULT_PATTERN "uniform"
+#define DEFAULT_WANT 0.5
+#define DEFAULT_SEED 1
+
+using namespace std;
+
+typedef struct {
+    int num_clients;
+    int num_files;
+    int min_segments;
+    int max_segments;
+    int num_trackers;
+    double seeders;
+    int pattern;
+    double want;
+    uint64_t seed;
+} swarm_config_t;
+
+
+/**
+ * Returns the next number of a splitmix64 generator. The standard distributions
+ * differ between libraries, this one gives the same swarm everywhere for a seed.
+*/
+static uint64_t next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+    return z ^ (z >> 31);
+}
+
+
+/**
+ * Returns a random number in [0, 1).
+*/
+static double random_fraction(uint64_t *state) {
+    return (next_random(state) >> 11) * (1.0 / (1ULL << 53));
+}
+
+
+/**
+ * Returns the code of a request pattern, -1 if there is no such pattern.
+*/
+static int request_pattern(const char *name) {
+    if (strcmp(name, "uniform") == 0) {
+        return PATTERN_UNIFORM;
+    }
+
+    if (strcmp(name, "all") == 0) {
+        return PATTERN_ALL;
+    }
+
+    if (strcmp(name, "zipf") == 0) {
+        return PATTERN_ZIPF;
+    }
+
+    return -1;
+}
+
+
+/**
+ * Reads the command line. Returns false on an invalid argument.
+*/
+static bool parse_arguments(int argc, char *argv[], swarm_config_t& config) {
+    if (argc < 5) {
+        return false;
+    }
+
+    config.num_clients = atoi(argv[1]);
+    config.num_files = atoi(argv[2]);
+    config.min_segments = atoi(argv[3]);
+    config.max_segments = atoi(argv[4]);
+    config.num_trackers = DEFAULT_TRACKERS;
+    config.seeders = DEFAULT_SEEDERS;
+    config.pattern = request_pattern(DEFAULT_PATTERN);
+    config.want = DEFAULT_WANT;
+    config.seed = DEFAULT_SEED;
+
+    for (int i = 5; i < argc; i++) {
+        if (strcmp(argv[i], "--trackers") == 0 && i + 1 < argc) {
+            config.num_trackers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seeders") == 0 && i + 1 < argc) {
+            config.seeders = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc) {
+            config.pattern = request_pattern(argv[++i]);
+        } else if (strcmp(argv[i], "--want") == 0 && i + 1 < argc) {
+            config.want = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            config.seed = strtoull(argv[++i], NULL, 10);
+        } else {
+            return false;
+        }
+    }
+
+    return config.num_clients > 0 && config.num_files > 0 && config.min_segments > 0 &&
+           config.max_segments >= config.min_segments && config.num_trackers > 0 &&
+           config.seeders >= 0 && config.seeders <= 1 && config.pattern != -1 &&
+           config.want >= 0 && config.want <= 1;
+}
+
+
+/**
+ * Returns the probability that a client wants a file it doesn't have. With the
+ * zipf pattern, file i is wanted 1 / (i + 1) as often as the first one, and a
+ * file is wanted with the probability given by --want on average.
+*/
+static double want_probability(const swarm_config_t& config, int file_index) {
+    if (config.pattern == PATTERN_ALL) {
+        return 1;
+    }
+
+    if (config.pattern == PATTERN_UNIFORM) {
+        return config.want;
+    }
+
+    double harmonic = 0;
+
+    for (int i = 1; i <= config.num_files; i++) {
+        harmonic += 1.0 / i;
+    }
+
+    double probability = config.want * config.num_files / (harmonic * (file_index + 1));
+
+    return probability < 1 ? probability : 1;
+}
+
+
+/**
+ * Writes the segments of a file as hex hashes, one per line.
+*/
+static void write_hashes(FILE *file, const vector<uint64_t>& hashes) {
+    for (int j = 0; j < (int) hashes.size(); j += 2) {
+        fprintf(file, "%016" PRIx64 "%016" PRIx64 "\n", hashes[j], hashes[j + 1]);
+    }
+}
+
+
+/**
+ * Generates the inputs of a swarm in the current directory, for a benchmark:
+ * in<rank>.txt for every client, out<i>.txt with the hashes of file i, as in the
+ * checker's tests, and wants.txt with a line per client, "<rank> <requested files>
+ * <requested segments>". Every file gets a random size and its seeders, the
+ * --seeders fraction of the clients but at least one, and every other client
+ * wants it with the probability of the request pattern. The same arguments give
+ * the same swarm:
+ * ./gen_swarm <clients> <files> <min segments> <max segments> [--trackers <n>]
+ *     [--seeders <fraction>] [--requests uniform|all|zipf] [--want <p>] [--seed <n>]
+*/
+int main(int argc, char *argv[]) {
+    swarm_config_t config;
+
+    if (!parse_arguments(argc, argv, config)) {
+        fprintf(stderr, "Usage: %s <clients> <files> <min segments> <max segments> [--trackers <n>]\n", argv[0]);
+        fprintf(stderr, "       [--seeders <fraction>] [--requests uniform|all|zipf] [--want <p>] [--seed <n>]\n");
+        return -1;
+    }
+
+    uint64_t state = config.seed;
+    int num_clients = config.num_clients;
+    int num_files = config.num_files;
+
+    // The hashes of each file, two random numbers per hash.
+    vector<vector<uint64_t>> hashes(num_files);
+
+    for (int i = 0; i < num_files; i++) {
+        int num_segments = config.min_segments + next_random(&state) % (config.max_segments - config.min_segments + 1);
+        hashes[i].resize(2 * num_segments);
+
+        for (auto& value : hashes[i]) {
+            value = next_random(&state);
+        }
+
+        string out_file = "out" + to_string(i + 1) + ".txt";
+        FILE *file = fopen(out_file.c_str(), "w");
+
+        if (file == NULL) {
+            fprintf(stderr, "Nu s-a putut scrie fisierul %s\n", out_file.c_str());
+            return -1;
+        }
+
+        write_hashes(file, hashes[i]);
+        fclose(file);
+    }
+
+    // has[j][i] is set if client j starts with file i, wants[j][i] if it requests it.
+    int num_seeders = (int) (config.seeders * num_clients + 0.5);
+    num_seeders = num_seeders < 1 ? 1 : num_seeders;
+
+    vector<vector<char>> has(num_clients, vector<char>(num_files, 0));
+    vector<vector<char>> wants(num_clients, vector<char>(num_files, 0));
+
+    for (int i = 0; i < num_files; i++) {
+
+        // The first num_seeders clients of a random permutation.
+        vector<int> clients(num_clients);
+
+        for (int j = 0; j < num_clients; j++) {
+            clients[j] = j;
+        }
+
+        for (int k = 0; k < num_seeders; k++) {
+            int other = k + next_random(&state) % (num_clients - k);
+            swap(clients[k], clients[other]);
+
+            has[clients[k]][i] = 1;
+        }
+
+        double probability = want_probability(config, i);
+
+        for (int j = 0; j < num_clients; j++) {
+            if (!has[j][i] && random_fraction(&state) < probability) {
+                wants[j][i] = 1;
+            }
+        }
+    }
+
+    FILE *summary = fopen("wants.txt", "w");
+
+    if (summary == NULL) {
+        fprintf(stderr, "Nu s-a putut scrie fisierul wants.txt\n");
+        return -1;
+    }
+
+    for (int j = 0; j < num_clients; j++) {
+        int rank = config.num_trackers + j;
+        string in_file = "in" + to_string(rank) + ".txt";
+        FILE *file = fopen(in_file.c_str(), "w");
+
+        if (file == NULL) {
+            fprintf(stderr, "Nu s-a putut scrie fisierul %s\n", in_file.c_str());
+            return -1;
+        }
+
+        int num_owned = 0;
+        int num_wanted = 0;
+        long wanted_segments = 0;
+
+        for (int i = 0; i < num_files; i++) {
+            num_owned += has[j][i];
+            num_wanted += wants[j][i];
+            wanted_segments += wants[j][i] ? hashes[i].size() / 2 : 0;
+        }
+
+        fprintf(file, "%d\n", num_owned);
+
+        for (int i = 0; i < num_files; i++) {
+            if (has[j][i]) {
+                fprintf(file, "file%d %d\n", i + 1, (int) hashes[i].size() / 2);
+                write_hashes(file, hashes[i]);
+            }
+        }
+
+        fprintf(file, "%d\n", num_wanted);
+
+        for (int i = 0; i < num_files; i++) {
+            if (wants[j][i]) {
+                fprintf(file, "file%d\n", i + 1);
+            }
+        }
+
+        fclose(file);
+
+        fprintf(summary, "%d %d %ld\n", rank, num_wanted, wanted_segments);
+    }
+
+    fclose(summary);
+
+    return 0;
+}
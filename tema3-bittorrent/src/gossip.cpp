@@ -0,0 +1,279 @@
+#include "gossip.h"
+#include "protocol.h"
+#include <algorithm>
+
+using namespace std;
+
+
+/**
+ * Creates the gossip state of a client, with the views it keeps, one per file.
+ * The neighbours are symmetric: a client is the neighbour of its neighbours.
+*/
+gossip_t create_gossip(int client, int num_clients, int distances, double interval, const vector<swarm_t>& views) {
+    gossip_t gossip;
+
+    for (int k = 0, distance = 1; k < distances && distance < num_clients; k++, distance *= 2) {
+        int neighbours[2] = {(client + distance) % num_clients, (client - distance + num_clients) % num_clients};
+
+        for (int neighbour : neighbours) {
+            int neighbour_rank = client_to_rank(neighbour);
+
+            if (neighbour != client && find(gossip.neighbours.begin(), gossip.neighbours.end(), neighbour_rank) == gossip.neighbours.end()) {
+                gossip.neighbours.push_back(neighbour_rank);
+            }
+        }
+    }
+
+    gossip.changed.resize(views.size());
+
+    // A message has each word of the views at most once, as a triple.
+    size_t max_message_size = 0;
+
+    for (int i = 0; i < (int) views.size(); i++) {
+        gossip.changed[i].assign(views[i].bits.size(), 0);
+        max_message_size += 3 * views[i].bits.size();
+    }
+
+    gossip.interval = interval;
+    gossip.last_send = 0;
+    gossip.send_requests.assign(gossip.neighbours.size(), MPI_REQUEST_NULL);
+    gossip.recv_requests.assign(gossip.neighbours.size(), MPI_REQUEST_NULL);
+    gossip.buffers.resize(gossip.neighbours.size());
+
+    for (int n = 0; n < (int) gossip.neighbours.size(); n++) {
+        gossip.buffers[n].resize(max_message_size);
+
+        MPI_Irecv(gossip.buffers[n].data(), max_message_size, MPI_UINT64_T, gossip.neighbours[n], GOSSIP_TAG,
+                  MPI_COMM_WORLD, &gossip.recv_requests[n]);
+    }
+
+    return gossip;
+}
+
+
+/**
+ * Adds the segments of a word of a client's bitset to the view of a file, and
+ * queues the word for the neighbours if it got new bits. Returns the new bits.
+*/
+bitset_word_t gossip_word(gossip_t& gossip, vector<swarm_t>& views, int file_index, int client, int word, bitset_word_t bits) {
+    swarm_t& view = views[file_index];
+    bitset_word_t added = merge_swarm_word(view, client, word, bits);
+
+    int k = client * view.num_words + word;
+
+    if (added != 0 && !gossip.changed[file_index][k]) {
+        gossip.changed[file_index][k] = 1;
+        gossip.pending.push_back(make_pair(file_index, k));
+    }
+
+    return added;
+}
+
+
+/**
+ * Returns when the next message to the neighbours is due, or -1 if there is nothing to send.
+*/
+double gossip_deadline(const gossip_t& gossip) {
+    if (gossip.pending.empty()) {
+        return -1;
+    }
+
+    return gossip.last_send + gossip.interval;
+}
+
+
+/**
+ * Sends the changed words to the neighbours, if it is time and the last
+ * message was delivered. Never blocks, the words wait for the next call.
+*/
+void send_gossip(gossip_t& gossip, const vector<swarm_t>& views) {
+    if (gossip.pending.empty() || MPI_Wtime() < gossip.last_send + gossip.interval) {
+        return;
+    }
+
+    int done;
+    MPI_Testall(gossip.send_requests.size(), gossip.send_requests.data(), &done, MPI_STATUSES_IGNORE);
+
+    if (!done) {
+        return;
+    }
+
+    gossip.message.clear();
+
+    for (auto& entry : gossip.pending) {
+        const swarm_t& view = views[entry.first];
+        uint64_t client = entry.second / view.num_words;
+        uint64_t word = entry.second % view.num_words;
+
+        gossip.message.push_back((uint64_t) entry.first << 32 | client);
+        gossip.message.push_back(word);
+        gossip.message.push_back(view.bits[entry.second]);
+
+        gossip.changed[entry.first][entry.second] = 0;
+    }
+
+    gossip.pending.clear();
+    gossip.last_send = MPI_Wtime();
+
+    for (int n = 0; n < (int) gossip.neighbours.size(); n++) {
+        MPI_Isend(&gossip.message[0], gossip.message.size(), MPI_UINT64_T, gossip.neighbours[n], GOSSIP_TAG,
+                  MPI_COMM_WORLD, &gossip.send_requests[n]);
+    }
+}
+
+
+/**
+ * Adds the message received from neighbours[n], of size words, to the views and
+ * posts the receive of the next one, unless it was the neighbour's empty message.
+ * Returns true if any view got new bits.
+*/
+static bool handle_gossip(gossip_t& gossip, vector<swarm_t>& views, int n, int size) {
+    const vector<bitset_word_t>& message = gossip.buffers[n];
+    bool added = false;
+
+    for (int e = 0; e + 2 < size; e += 3) {
+        int file_index = message[e] >> 32;
+        int client = message[e] & 0xffffffff;
+        int word = message[e + 1];
+
+        // Words of files this client has no view of, or out of range, are ignored.
+        if (file_index >= (int) views.size() || client >= views[file_index].num_clients || word >= views[file_index].num_words) {
+            continue;
+        }
+
+        if (gossip_word(gossip, views, file_index, client, word, message[e + 2]) != 0) {
+            added = true;
+        }
+    }
+
+    // The neighbour stopped before this client.
+    if (size == 0) {
+        return added;
+    }
+
+    MPI_Irecv(gossip.buffers[n].data(), gossip.buffers[n].size(), MPI_UINT64_T, gossip.neighbours[n], GOSSIP_TAG,
+              MPI_COMM_WORLD, &gossip.recv_requests[n]);
+
+    return added;
+}
+
+
+/**
+ * Receives the messages of the neighbours and adds them to the views, queuing
+ * the new bits to be passed on. Returns true if any view got new bits.
+*/
+bool receive_gossip(gossip_t& gossip, vector<swarm_t>& views) {
+    int num_neighbours = gossip.neighbours.size();
+    vector<int> indices(num_neighbours);
+    vector<MPI_Status> statuses(num_neighbours);
+    bool added = false;
+
+    while (true) {
+        int num_completed;
+        MPI_Testsome(num_neighbours, gossip.recv_requests.data(), &num_completed, indices.data(), statuses.data());
+
+        if (num_completed == 0 || num_completed == MPI_UNDEFINED) {
+            return added;
+        }
+
+        for (int c = 0; c < num_completed; c++) {
+            int size;
+            MPI_Get_count(&statuses[c], MPI_UINT64_T, &size);
+
+            if (handle_gossip(gossip, views, indices[c], size)) {
+                added = true;
+            }
+        }
+    }
+}
+
+
+/**
+ * Blocks until a neighbour's message arrives, the changed words are due to be sent
+ * (or the sends of the last message they wait for finish), or the timer is woken.
+ * Adds the messages that arrived to the views, returns true if any got new bits.
+*/
+bool wait_gossip(gossip_t& gossip, vector<swarm_t>& views, wake_timer_t *timer) {
+    int num_neighbours = gossip.neighbours.size();
+    double deadline = -1;
+    bool wait_sends = false;
+
+    if (!gossip.pending.empty()) {
+        int done;
+        MPI_Testall(num_neighbours, gossip.send_requests.data(), &done, MPI_STATUSES_IGNORE);
+
+        wait_sends = !done;
+        deadline = done ? gossip.last_send + gossip.interval : -1;
+    }
+
+    // The receives, then the sends if they are waited on, then the timer.
+    vector<MPI_Request> requests(gossip.recv_requests);
+
+    if (wait_sends) {
+        requests.insert(requests.end(), gossip.send_requests.begin(), gossip.send_requests.end());
+    }
+
+    int timer_index = requests.size();
+    requests.push_back(MPI_REQUEST_NULL);
+    start_wake_timer(timer, deadline, &requests[timer_index]);
+
+    vector<int> indices(requests.size());
+    vector<MPI_Status> statuses(requests.size());
+    int num_completed;
+
+    MPI_Waitsome(requests.size(), requests.data(), &num_completed, indices.data(), statuses.data());
+
+    finish_wake_timer(timer, &requests[timer_index]);
+
+    copy(requests.begin(), requests.begin() + num_neighbours, gossip.recv_requests.begin());
+
+    if (wait_sends) {
+        copy(requests.begin() + num_neighbours, requests.begin() + 2 * num_neighbours, gossip.send_requests.begin());
+    }
+
+    bool added = false;
+
+    for (int c = 0; c < num_completed; c++) {
+        if (indices[c] < num_neighbours) {
+            int size;
+            MPI_Get_count(&statuses[c], MPI_UINT64_T, &size);
+
+            if (handle_gossip(gossip, views, indices[c], size)) {
+                added = true;
+            }
+        }
+    }
+
+    return added;
+}
+
+
+/**
+ * Stops the exchange once all the clients are done: tells the neighbours with
+ * an empty message, and receives their messages up to their empty one, so no
+ * send is left unmatched. Messages from the same neighbour come in order.
+*/
+void finish_gossip(gossip_t& gossip) {
+    MPI_Waitall(gossip.send_requests.size(), gossip.send_requests.data(), MPI_STATUSES_IGNORE);
+
+    for (int n = 0; n < (int) gossip.neighbours.size(); n++) {
+        MPI_Isend(NULL, 0, MPI_UINT64_T, gossip.neighbours[n], GOSSIP_TAG, MPI_COMM_WORLD, &gossip.send_requests[n]);
+    }
+
+    for (int n = 0; n < (int) gossip.neighbours.size(); n++) {
+        while (gossip.recv_requests[n] != MPI_REQUEST_NULL) {
+            MPI_Status s;
+            int size;
+
+            MPI_Wait(&gossip.recv_requests[n], &s);
+            MPI_Get_count(&s, MPI_UINT64_T, &size);
+
+            if (size != 0) {
+                MPI_Irecv(gossip.buffers[n].data(), gossip.buffers[n].size(), MPI_UINT64_T, gossip.neighbours[n], GOSSIP_TAG,
+                          MPI_COMM_WORLD, &gossip.recv_requests[n]);
+            }
+        }
+    }
+
+    MPI_Waitall(gossip.send_requests.size(), gossip.send_requests.data(), MPI_STATUSES_IGNORE);
+}
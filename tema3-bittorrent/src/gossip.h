@@ -0,0 +1,52 @@
+#ifndef GOSSIP_H
+#define GOSSIP_H
+
+#include <mpi.h>
+#include <utility>
+#include <vector>
+
+#include "swarm.h"
+#include "wake_timer.h"
+
+// Tag of the have-bitmaps a client sends to its neighbours, as MPI_UINT64_T triples
+// (file_index << 32 | client, word, bits): word of the bitset of that client in the
+// swarm of that file. An empty message at shutdown means the neighbour sends no more.
+#define GOSSIP_TAG 11
+
+// In gossip mode (--gossip <k>), a client doesn't ask the trackers for the swarms.
+// It keeps a view of every swarm and exchanges the words that changed with the
+// clients at distance 1, 2, 4, ..., 2^(k-1) on both sides of it, which pass them on.
+// A receive is kept posted for each neighbour, so a client with nothing else to do
+// can block until a message arrives or its own words are due (wait_gossip()).
+typedef struct {
+    std::vector<int> neighbours;
+
+    // The message of neighbours[n] is received in buffers[n], which fits every word
+    // of the views, by recv_requests[n], MPI_REQUEST_NULL once the neighbour is done.
+    std::vector<std::vector<bitset_word_t>> buffers;
+    std::vector<MPI_Request> recv_requests;
+
+    // Words of the views that got bits the neighbours weren't sent yet, as (file, word
+    // in swarm.bits) pairs in the order they changed. changed[i][k] is set while
+    // word k of the swarm of file i is in pending.
+    std::vector<std::vector<char>> changed;
+    std::vector<std::pair<int, int>> pending;
+
+    // Shortest time between two messages, and when the last one was sent, in seconds.
+    double interval;
+    double last_send;
+
+    // The last message, kept until it was sent to all the neighbours.
+    std::vector<bitset_word_t> message;
+    std::vector<MPI_Request> send_requests;
+} gossip_t;
+
+gossip_t create_gossip(int client, int num_clients, int distances, double interval, const std::vector<swarm_t>& views);
+bitset_word_t gossip_word(gossip_t& gossip, std::vector<swarm_t>& views, int file_index, int client, int word, bitset_word_t bits);
+double gossip_deadline(const gossip_t& gossip);
+void send_gossip(gossip_t& gossip, const std::vector<swarm_t>& views);
+bool receive_gossip(gossip_t& gossip, std::vector<swarm_t>& views);
+bool wait_gossip(gossip_t& gossip, std::vector<swarm_t>& views, wake_timer_t *timer);
+void finish_gossip(gossip_t& gossip);
+
+#endif
@@ -0,0 +1,94 @@
+#include "hash_store.h"
+#include <string.h>
+
+using namespace std;
+
+
+/**
+ * Returns the entry of a file, adding empty entries up to it if needed.
+*/
+static stored_file_t& file_entry(hash_store_t& store, int file_index) {
+    if (file_index >= (int) store.files.size()) {
+        stored_file_t empty = {0, 0, NULL};
+        store.files.resize(file_index + 1, empty);
+    }
+
+    return store.files[file_index];
+}
+
+
+/**
+ * Reserves the slots for the segments of a file at the end of the arena.
+ * The arena may move, so files are only added before the threads start.
+*/
+void add_file(hash_store_t& store, int file_index, int num_segments) {
+    stored_file_t& file = file_entry(store, file_index);
+
+    file.num_segments = num_segments;
+    file.offset = store.slots.size();
+    file.view = NULL;
+
+    store.slots.resize(store.slots.size() + num_segments);
+}
+
+
+/**
+ * Adds a file whose hashes stay where they are, one after the other
+ * starting at view. The memory must outlive the store.
+*/
+void add_file_view(hash_store_t& store, int file_index, int num_segments, const digest_t *view) {
+    stored_file_t& file = file_entry(store, file_index);
+
+    file.num_segments = num_segments;
+    file.offset = 0;
+    file.view = view;
+}
+
+
+/**
+ * Returns the number of segments stored for a file, 0 if it was never added.
+*/
+int num_stored_segments(const hash_store_t& store, int file_index) {
+    if (file_index < 0 || file_index >= (int) store.files.size()) {
+        return 0;
+    }
+
+    return store.files[file_index].num_segments;
+}
+
+
+/**
+ * Returns the hash of a segment.
+*/
+const digest_t& segment_hash(const hash_store_t& store, int file_index, int segment_index) {
+    const stored_file_t& file = store.files[file_index];
+
+    if (file.view != NULL) {
+        return file.view[segment_index];
+    }
+
+    return store.slots[file.offset + segment_index];
+}
+
+
+/**
+ * Returns the slot of a segment of a file in the arena, to write its hash.
+*/
+digest_t& segment_slot(hash_store_t& store, int file_index, int segment_index) {
+    return store.slots[store.files[file_index].offset + segment_index];
+}
+
+
+/**
+ * Returns a fingerprint of the hashes of a file: the first 8 bytes of the hash of
+ * its first segment, random for every file. 0 for a file without segments.
+*/
+uint64_t file_fingerprint(const hash_store_t& store, int file_index) {
+    uint64_t fingerprint = 0;
+
+    if (num_stored_segments(store, file_index) > 0) {
+        memcpy(&fingerprint, segment_hash(store, file_index, 0).bytes, sizeof(fingerprint));
+    }
+
+    return fingerprint;
+}
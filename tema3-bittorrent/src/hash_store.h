@@ -0,0 +1,35 @@
+#ifndef HASH_STORE_H
+#define HASH_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "digest.h"
+
+typedef struct {
+    int num_segments;
+
+    // Files whose hashes had to be converted, or are downloaded, are in the arena,
+    // starting at slot offset. Files read from a binary input point into its mapping
+    // instead, view is the first hash. view is NULL for files in the arena.
+    size_t offset;
+    const digest_t *view;
+} stored_file_t;
+
+// The hashes of all the files a client has or downloads. The arena is one
+// contiguous vector of digests, the segments of a file are in consecutive
+// slots and the files are placed in the order they are added.
+typedef struct {
+    std::vector<stored_file_t> files;
+    std::vector<digest_t> slots;
+} hash_store_t;
+
+void add_file(hash_store_t& store, int file_index, int num_segments);
+void add_file_view(hash_store_t& store, int file_index, int num_segments, const digest_t *view);
+int num_stored_segments(const hash_store_t& store, int file_index);
+const digest_t& segment_hash(const hash_store_t& store, int file_index, int segment_index);
+digest_t& segment_slot(hash_store_t& store, int file_index, int segment_index);
+uint64_t file_fingerprint(const hash_store_t& store, int file_index);
+
+#endif
@@ -0,0 +1,118 @@
+#include "hash_window.h"
+
+using namespace std;
+
+
+/**
+ * Creates the window, a collective over all the ranks. files is the hash store of a
+ * client, NULL for a tracker, which exposes nothing. The store must not grow anymore.
+ * Clients start their shared lock on all the ranks, kept until the window is freed.
+*/
+hash_window_t *create_hash_window(const hash_store_t *files, int num_files) {
+    hash_window_t *window = new hash_window_t;
+    window->num_files = num_files;
+
+    MPI_Win_create_dynamic(MPI_INFO_NULL, MPI_COMM_WORLD, &window->win);
+
+    // Under the separate model, the stores of the owner's threads may not reach the copy
+    // of the memory the others read from, so it publishes no addresses and is asked with messages.
+    int *model;
+    int flag;
+    MPI_Win_get_attr(window->win, MPI_WIN_MODEL, &model, &flag);
+
+    bool unified = flag && *model == MPI_WIN_UNIFIED;
+
+    vector<MPI_Aint> own_addresses(num_files, 0);
+
+    if (files != NULL && unified) {
+
+        // The arena, in one piece.
+        if (!files->slots.empty()) {
+            void *arena = (void *) files->slots.data();
+
+            MPI_Win_attach(window->win, arena, files->slots.size() * sizeof(digest_t));
+        }
+
+        // The views, from the first one to the end of the last one, all in the same mapping.
+        const char *views_start = NULL;
+        const char *views_end = NULL;
+
+        for (const stored_file_t& file : files->files) {
+            if (file.view != NULL && file.num_segments > 0) {
+                const char *start = (const char *) file.view;
+                const char *end = (const char *) (file.view + file.num_segments);
+
+                if (views_start == NULL || start < views_start) {
+                    views_start = start;
+                }
+
+                if (views_end == NULL || end > views_end) {
+                    views_end = end;
+                }
+            }
+        }
+
+        if (views_start != NULL) {
+            MPI_Win_attach(window->win, (void *) views_start, views_end - views_start);
+        }
+
+        for (int i = 0; i < num_files; i++) {
+            if (num_stored_segments(*files, i) > 0) {
+                MPI_Get_address(&segment_hash(*files, i, 0), &own_addresses[i]);
+            }
+        }
+    }
+
+    int num_ranks;
+    MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
+
+    window->addresses.resize((size_t) num_ranks * num_files);
+    MPI_Allgather(own_addresses.data(), num_files, MPI_AINT, window->addresses.data(), num_files, MPI_AINT, MPI_COMM_WORLD);
+
+    window->locked = files != NULL;
+
+    if (window->locked) {
+        MPI_Win_lock_all(0, window->win);
+    }
+
+    return window;
+}
+
+
+/**
+ * Returns the address of the first hash of a file at a rank, 0 if it isn't exposed there.
+*/
+MPI_Aint remote_hash_address(const hash_window_t *window, int rank, int file_index) {
+    if (file_index >= window->num_files) {
+        return 0;
+    }
+
+    return window->addresses[(size_t) rank * window->num_files + file_index];
+}
+
+
+/**
+ * Synchronizes the memory of this client with the window: after storing hashes, so
+ * the others read them once they are announced, and before a read from another
+ * client. Only during the shared lock of a client, nothing otherwise.
+*/
+void sync_hash_window(hash_window_t *window) {
+    if (window != NULL && window->locked) {
+        MPI_Win_sync(window->win);
+    }
+}
+
+
+/**
+ * Frees the window, a collective over all the ranks, once this rank doesn't read
+ * from it anymore. Freeing waits for the reads of the others, and detaches the memory.
+*/
+void destroy_hash_window(hash_window_t *window) {
+    if (window->locked) {
+        MPI_Win_unlock_all(window->win);
+    }
+
+    MPI_Win_free(&window->win);
+
+    delete window;
+}
@@ -0,0 +1,34 @@
+#ifndef HASH_WINDOW_H
+#define HASH_WINDOW_H
+
+#include <mpi.h>
+#include <vector>
+
+#include "hash_store.h"
+
+// One-sided access to the hashes of the clients (--rma). Every client attaches
+// its hash store to a dynamic window: the arena and the part of the input mapping
+// the file views point into. The address of the first hash of each file is
+// published to all the ranks, and the downloaders read the hashes with MPI_Rget
+// during a shared lock on all the ranks, without the owner's threads. Only a
+// client whose window has the unified memory model exposes its hashes, the others
+// are asked with messages. The owner calls MPI_Win_sync after storing hashes and
+// before announcing them, and the reader before each read (sync_hash_window()).
+typedef struct {
+    MPI_Win win;
+    int num_files;
+
+    // addresses[r * num_files + i] is the address of the first hash of file i
+    // at rank r, 0 if rank r doesn't store that file.
+    std::vector<MPI_Aint> addresses;
+
+    // Set while the shared lock on all the ranks is held, only by the clients.
+    bool locked;
+} hash_window_t;
+
+hash_window_t *create_hash_window(const hash_store_t *files, int num_files);
+MPI_Aint remote_hash_address(const hash_window_t *window, int rank, int file_index);
+void sync_hash_window(hash_window_t *window);
+void destroy_hash_window(hash_window_t *window);
+
+#endif
@@ -0,0 +1,371 @@
+#include "input.h"
+#include <algorithm>
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Position of the parser in the mapping.
+typedef struct {
+    const char *position;
+    const char *end;
+} cursor_t;
+
+
+/**
+ * Converts the file name to an index.
+*/
+int name_to_index(const string& filename) {
+    string number;
+
+    for (char c : filename) {
+        if (isdigit(c)) {
+            number += c;
+        }
+    }
+
+    return stoi(number) - 1;
+}
+
+
+/**
+ * Converts a given index to a file name.
+*/
+string index_to_name(int index) {
+    return "file" + to_string(index+1);
+}
+
+
+/**
+ * Finds the next whitespace separated token. Returns its length, 0 at the end of the input.
+*/
+static size_t next_token(cursor_t& cursor, const char **token) {
+    while (cursor.position < cursor.end && isspace(*cursor.position)) {
+        cursor.position++;
+    }
+
+    *token = cursor.position;
+
+    while (cursor.position < cursor.end && !isspace(*cursor.position)) {
+        cursor.position++;
+    }
+
+    return cursor.position - *token;
+}
+
+
+/**
+ * Reads a non-negative integer token.
+*/
+static bool next_int(cursor_t& cursor, int *value) {
+    const char *token;
+    size_t length = next_token(cursor, &token);
+
+    if (length == 0) {
+        return false;
+    }
+
+    *value = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        if (!isdigit(token[i])) {
+            return false;
+        }
+
+        *value = *value * 10 + (token[i] - '0');
+    }
+
+    return true;
+}
+
+
+/**
+ * Reads a file name token and converts it to an index.
+*/
+static bool next_file_index(cursor_t& cursor, int *file_index) {
+    const char *token;
+    size_t length = next_token(cursor, &token);
+
+    string name(token, length);
+
+    if (strcspn(name.c_str(), "0123456789") == length) {
+        return false;
+    }
+
+    *file_index = name_to_index(name);
+
+    return *file_index >= 0;
+}
+
+
+/**
+ * Reads the hex hashes of a file into its slots.
+*/
+static bool read_text_segments(cursor_t& cursor, hash_store_t& files, int file_index, int num_segments) {
+    add_file(files, file_index, num_segments);
+
+    for (int j = 0; j < num_segments; j++) {
+        const char *token;
+        size_t length = next_token(cursor, &token);
+
+        if (!digest_from_hex(token, length, &segment_slot(files, file_index, j))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * Adds a file to the list of files the peer has, or wants when requested is set.
+*/
+static void add_input_file(input_t& input, int file_index, int num_segments, bool requested) {
+    vector<int>& files = requested ? input.requested_files : input.file_sizes;
+
+    if (file_index >= (int) files.size()) {
+        files.resize(file_index + 1, 0);
+    }
+
+    files[file_index] = requested ? 1 : num_segments;
+}
+
+
+/**
+ * Reads a text input file.
+*/
+static bool parse_text_input(cursor_t& cursor, input_t& input, hash_store_t& files) {
+
+    // Read the number of files this client has, then the segments of each file.
+    if (!next_int(cursor, &input.num_files)) {
+        return false;
+    }
+
+    for (int i = 0; i < input.num_files; i++) {
+        int file_index;
+        int num_segments;
+
+        if (!next_file_index(cursor, &file_index) || !next_int(cursor, &num_segments)) {
+            return false;
+        }
+
+        add_input_file(input, file_index, num_segments, false);
+
+        if (!read_text_segments(cursor, files, file_index, num_segments)) {
+            return false;
+        }
+    }
+
+    // Read the number of files the client wants to download, then their names.
+    if (!next_int(cursor, &input.num_requested_files)) {
+        return false;
+    }
+
+    for (int i = 0; i < input.num_requested_files; i++) {
+        int file_index;
+
+        if (!next_file_index(cursor, &file_index)) {
+            return false;
+        }
+
+        add_input_file(input, file_index, 0, true);
+    }
+
+    return true;
+}
+
+
+/**
+ * Reads a 32-bit int of a binary input file.
+*/
+static bool next_binary_int(cursor_t& cursor, int *value) {
+    if (cursor.end - cursor.position < (long) sizeof(int32_t)) {
+        return false;
+    }
+
+    int32_t number;
+    memcpy(&number, cursor.position, sizeof(number));
+    cursor.position += sizeof(number);
+
+    *value = number;
+
+    return number >= 0;
+}
+
+
+/**
+ * Reads a binary input file, after the magic. The hashes are left in the mapping.
+*/
+static bool parse_binary_input(cursor_t& cursor, input_t& input, hash_store_t& files) {
+    if (!next_binary_int(cursor, &input.num_files)) {
+        return false;
+    }
+
+    for (int i = 0; i < input.num_files; i++) {
+        int file_index;
+        int num_segments;
+
+        if (!next_binary_int(cursor, &file_index) || !next_binary_int(cursor, &num_segments)) {
+            return false;
+        }
+
+        size_t hashes_size = (size_t) num_segments * sizeof(digest_t);
+
+        if ((size_t) (cursor.end - cursor.position) < hashes_size) {
+            return false;
+        }
+
+        add_input_file(input, file_index, num_segments, false);
+        add_file_view(files, file_index, num_segments, (const digest_t *) cursor.position);
+
+        cursor.position += hashes_size;
+    }
+
+    if (!next_binary_int(cursor, &input.num_requested_files)) {
+        return false;
+    }
+
+    for (int i = 0; i < input.num_requested_files; i++) {
+        int file_index;
+
+        if (!next_binary_int(cursor, &file_index)) {
+            return false;
+        }
+
+        add_input_file(input, file_index, 0, true);
+    }
+
+    return true;
+}
+
+
+/**
+ * Maps a peer's input file and reads it, as binary if it starts with
+ * INPUT_BINARY_MAGIC and as text otherwise. The hashes of the files it has
+ * are added to the store. Returns false if the file can't be read or is malformed,
+ * with nothing left open or mapped; the store shouldn't be used then.
+*/
+bool load_input(const char *path, input_t& input, hash_store_t& files) {
+    input.data = NULL;
+    input.size = 0;
+    input.num_files = 0;
+    input.num_requested_files = 0;
+    input.file_sizes.clear();
+    input.requested_files.clear();
+
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    // The file is read once, front to back.
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    input.data = (const char *) data;
+    input.size = st.st_size;
+
+    cursor_t cursor = {input.data, input.data + input.size};
+    bool valid;
+
+    if (input.size >= INPUT_BINARY_MAGIC_SIZE && memcmp(input.data, INPUT_BINARY_MAGIC, INPUT_BINARY_MAGIC_SIZE) == 0) {
+        cursor.position += INPUT_BINARY_MAGIC_SIZE;
+        valid = parse_binary_input(cursor, input, files);
+    } else {
+        valid = parse_text_input(cursor, input, files);
+    }
+
+    // A malformed file isn't kept mapped. The views it added to the store are gone with it.
+    if (!valid) {
+        unload_input(input);
+        return false;
+    }
+
+    // From now on the upload threads read the hashes in any order.
+    madvise(data, st.st_size, MADV_NORMAL);
+
+    return true;
+}
+
+
+/**
+ * Writes a 32-bit int of a binary input file.
+*/
+static void write_binary_int(FILE *file, int value) {
+    int32_t number = value;
+    fwrite(&number, sizeof(number), 1, file);
+}
+
+
+/**
+ * Writes the files the peer has and the requested ones as a binary input file,
+ * which load_input() reads without converting the hashes.
+*/
+bool write_binary_input(const char *path, const input_t& input, const hash_store_t& files) {
+    FILE *file = fopen(path, "wb");
+
+    if (file == NULL) {
+        return false;
+    }
+
+    int num_files = input.file_sizes.size() - count(input.file_sizes.begin(), input.file_sizes.end(), 0);
+    int num_requested_files = count(input.requested_files.begin(), input.requested_files.end(), 1);
+
+    fwrite(INPUT_BINARY_MAGIC, 1, INPUT_BINARY_MAGIC_SIZE, file);
+    write_binary_int(file, num_files);
+
+    for (int i = 0; i < (int) input.file_sizes.size(); i++) {
+        if (input.file_sizes[i] == 0) {
+            continue;
+        }
+
+        write_binary_int(file, i);
+        write_binary_int(file, input.file_sizes[i]);
+
+        for (int j = 0; j < input.file_sizes[i]; j++) {
+            fwrite(&segment_hash(files, i, j), sizeof(digest_t), 1, file);
+        }
+    }
+
+    write_binary_int(file, num_requested_files);
+
+    for (int i = 0; i < (int) input.requested_files.size(); i++) {
+        if (input.requested_files[i] != 0) {
+            write_binary_int(file, i);
+        }
+    }
+
+    return fclose(file) == 0;
+}
+
+
+/**
+ * Unmaps the input file. The hashes of the files read from it are gone afterwards.
+*/
+void unload_input(input_t& input) {
+    if (input.data != NULL) {
+        munmap((void *) input.data, input.size);
+        input.data = NULL;
+    }
+}
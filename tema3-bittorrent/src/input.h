@@ -0,0 +1,40 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "hash_store.h"
+
+// Binary input files start with INPUT_BINARY_MAGIC, then hold the same fields as
+// the text ones as 32-bit ints in host order, and the hashes as DIGEST_SIZE bytes:
+// num_files, for each file (file_index, num_segments, hashes...),
+// num_requested_files, then the index of each requested file.
+#define INPUT_BINARY_MAGIC "T3HB"
+#define INPUT_BINARY_MAGIC_SIZE 4
+
+// A peer's input file, mapped in memory. The hashes of a text file are converted
+// to digests in the hash store. The hashes of a binary file are not copied, the
+// hash store points into the mapping, so it stays mapped until the peer is done.
+typedef struct {
+    const char *data;
+    size_t size;
+
+    int num_files;
+    int num_requested_files;
+
+    // file_sizes[i] is the number of segments of file i the peer has, 0 if it doesn't have it.
+    std::vector<int> file_sizes;
+
+    // requested_files[i] is 1 if the peer wants to download file i.
+    std::vector<int> requested_files;
+} input_t;
+
+int name_to_index(const std::string& filename);
+std::string index_to_name(int index);
+bool load_input(const char *path, input_t& input, hash_store_t& files);
+void unload_input(input_t& input);
+bool write_binary_input(const char *path, const input_t& input, const hash_store_t& files);
+
+#endif
@@ -0,0 +1,49 @@
+#include "messages.h"
+#include <stddef.h>
+
+datatype_registry_t datatypes;
+
+
+/**
+ * Create an MPI datatype to use when sending a peer_message_t struct.
+*/
+MPI_Datatype create_peer_message_datatype() {
+    MPI_Datatype peer_message_datatype;
+    int block_lengths[3] = {1, 1, 1};
+    MPI_Datatype types[3] = {MPI_INT, MPI_INT, MPI_UINT64_T};
+
+    MPI_Aint offsets[3];
+    offsets[0] = offsetof(peer_message_t, file_index);
+    offsets[1] = offsetof(peer_message_t, segment_index);
+    offsets[2] = offsetof(peer_message_t, segments);
+
+    MPI_Type_create_struct(3, block_lengths, offsets, types, &peer_message_datatype);
+    MPI_Type_commit(&peer_message_datatype);
+
+    return peer_message_datatype;
+}
+
+
+/**
+ * Returns the size in bytes of a hash_reply_t carrying num_hashes hashes.
+ * The reply is sent as MPI_BYTE, its length depends on the batch.
+*/
+int hash_reply_size(int num_hashes) {
+    return offsetof(hash_reply_t, hashes) + num_hashes * sizeof(digest_t);
+}
+
+
+/**
+ * Creates the datatypes of all the messages. Called once, after MPI_Init.
+*/
+void create_datatypes() {
+    datatypes.peer_message = create_peer_message_datatype();
+}
+
+
+/**
+ * Frees the datatypes created by create_datatypes(). Called before MPI_Finalize.
+*/
+void free_datatypes() {
+    MPI_Type_free(&datatypes.peer_message);
+}
@@ -0,0 +1,44 @@
+#ifndef MESSAGES_H
+#define MESSAGES_H
+
+#include <mpi.h>
+#include <stdint.h>
+
+#include "digest.h"
+
+// Most segments a peer asks for in one request, one bit each in peer_message_t.segments.
+#define MAX_REQUEST_BATCH 64
+
+// Request for the hashes of a batch of segments of a file, all in the same
+// block of MAX_REQUEST_BATCH segments: bit k of segments is set if segment
+// segment_index + k is requested. segment_index is a multiple of MAX_REQUEST_BATCH.
+typedef struct {
+    int file_index;
+    int segment_index;
+    uint64_t segments;
+} peer_message_t;
+
+// Reply to a peer_message_t, with the hashes of the requested segments in
+// increasing order. Only the hashes that were requested are sent, as
+// hash_reply_size() bytes.
+typedef struct {
+    int file_index;
+    int segment_index;
+    uint64_t segments;
+    digest_t hashes[MAX_REQUEST_BATCH];
+} hash_reply_t;
+
+// Committed datatypes for the fixed size messages above, created once by create_datatypes()
+// before the threads start and only read afterwards, so all threads share them.
+typedef struct {
+    MPI_Datatype peer_message;
+} datatype_registry_t;
+
+extern datatype_registry_t datatypes;
+
+MPI_Datatype create_peer_message_datatype();
+int hash_reply_size(int num_hashes);
+void create_datatypes();
+void free_datatypes();
+
+#endif
@@ -0,0 +1,272 @@
+#include "output_writer.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+#include "checkpoint.h"
+
+using namespace std;
+
+
+/**
+ * Returns the policy with the given name, one of "none", "file" and "always", or -1.
+*/
+int find_fsync_policy(const char *name) {
+    if (strcmp(name, "none") == 0) {
+        return FSYNC_NONE;
+    }
+
+    if (strcmp(name, "file") == 0) {
+        return FSYNC_FILE;
+    }
+
+    if (strcmp(name, "always") == 0) {
+        return FSYNC_ALWAYS;
+    }
+
+    return -1;
+}
+
+
+/**
+ * Returns the size of a segment in the output file, a hex line or a binary digest.
+*/
+static size_t record_size(const output_writer_t *writer) {
+    return writer->binary ? sizeof(digest_t) : DIGEST_HEX_SIZE + 1;
+}
+
+
+/**
+ * Writes a batch of hashes. Each run of consecutive segments is one pwrite().
+*/
+static void write_job_segments(output_writer_t *writer, const hash_reply_t& hashes) {
+    int fd = writer->fds[hashes.file_index];
+    size_t size = record_size(writer);
+
+    char buffer[MAX_REQUEST_BATCH * (DIGEST_HEX_SIZE + 1)];
+    uint64_t segments = hashes.segments;
+    int h = 0;
+
+    while (segments != 0) {
+        int first = __builtin_ctzll(segments);
+        int length = 0;
+
+        // Take set bits from the lowest one while they are consecutive.
+        while (segments != 0 && __builtin_ctzll(segments) == first + length) {
+            char *record = buffer + length * size;
+
+            if (writer->binary) {
+                memcpy(record, &hashes.hashes[h], sizeof(digest_t));
+            } else {
+                digest_to_hex(hashes.hashes[h], record);
+                record[DIGEST_HEX_SIZE] = '\n';
+            }
+
+            segments &= segments - 1;
+            length++;
+            h++;
+        }
+
+        off_t offset = (off_t) (hashes.segment_index + first) * size;
+
+        if (pwrite(fd, buffer, length * size, offset) != (ssize_t) (length * size)) {
+            perror("pwrite");
+        }
+    }
+
+    // The progress file must not get to disk before the hashes it records, except
+    // with FSYNC_NONE, whose checkpoints only survive the death of the process.
+    if (writer->fsync_policy != FSYNC_NONE) {
+        fdatasync(fd);
+    }
+
+    // The hashes are written, record them in the progress file.
+    int word = hashes.segment_index / BITS_PER_WORD;
+    int progress_fd = writer->progress_fds[hashes.file_index];
+    bitset_word_t& have = writer->have[hashes.file_index][word];
+
+    have |= hashes.segments;
+
+    off_t offset = CHECKPOINT_HEADER_SIZE * sizeof(int32_t) + word * sizeof(bitset_word_t);
+
+    if (pwrite(progress_fd, &have, sizeof(have), offset) != sizeof(have)) {
+        perror("pwrite");
+    }
+
+    if (writer->fsync_policy == FSYNC_ALWAYS) {
+        fdatasync(progress_fd);
+    }
+}
+
+
+/**
+ * Thread function that does the writes queued by the download thread, in order.
+*/
+static void *output_writer_func(void *arg) {
+    output_writer_t *writer = (output_writer_t *) arg;
+
+    while (true) {
+        pthread_mutex_lock(&writer->mutex);
+
+        while (writer->jobs.empty()) {
+            pthread_cond_wait(&writer->job_ready, &writer->mutex);
+        }
+
+        write_job_t job = writer->jobs.front();
+        writer->jobs.pop_front();
+
+        pthread_mutex_unlock(&writer->mutex);
+
+        if (job.kind == WRITE_STOP) {
+            return NULL;
+        }
+
+        if (job.kind == WRITE_SEGMENTS) {
+            write_job_segments(writer, job.hashes);
+        } else if (job.kind == WRITE_FILE_COMPLETE) {
+            // The progress file stays, a complete one tells a restarted client it has the file.
+            int& fd = writer->fds[job.hashes.file_index];
+            int& progress_fd = writer->progress_fds[job.hashes.file_index];
+
+            if (writer->fsync_policy != FSYNC_NONE) {
+                fsync(fd);
+                fsync(progress_fd);
+            }
+
+            close(fd);
+            close(progress_fd);
+            fd = -1;
+            progress_fd = -1;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Adds a job to the writer's queue.
+*/
+static void push_job(output_writer_t *writer, const write_job_t& job) {
+    pthread_mutex_lock(&writer->mutex);
+    writer->jobs.push_back(job);
+    pthread_cond_signal(&writer->job_ready);
+    pthread_mutex_unlock(&writer->mutex);
+}
+
+
+/**
+ * Creates the progress file of an output, with the segments it already has.
+*/
+static int create_progress_file(int rank, int file_index, int num_segments, uint64_t fingerprint, bool binary,
+                                const vector<bitset_word_t>& have) {
+    string filename = checkpoint_file_name(rank, file_index);
+    int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    int32_t header[CHECKPOINT_HEADER_SIZE] = {CHECKPOINT_MAGIC, num_segments, binary ? 1 : 0,
+                                              (int32_t) (uint32_t) fingerprint, (int32_t) (uint32_t) (fingerprint >> 32)};
+    size_t size = have.size() * sizeof(bitset_word_t);
+
+    if (fd < 0 || write(fd, header, sizeof(header)) != sizeof(header) || write(fd, have.data(), size) != (ssize_t) size) {
+        fprintf(stderr, "Nu s-a putut crea fisierul %s\n", filename.c_str());
+        exit(-1);
+    }
+
+    return fd;
+}
+
+
+/**
+ * Creates the output file of every requested file at its final size, keeping
+ * the segments of a resumed download (have[i]), and starts the writer thread.
+ * The progress files record the fingerprint of each file (file_fingerprint()).
+*/
+output_writer_t *create_output_writer(int rank, const vector<int>& file_sizes, const vector<uint64_t>& fingerprints,
+                                      const vector<int>& requested_files, const vector<vector<bitset_word_t>>& have,
+                                      int fsync_policy, bool binary) {
+    output_writer_t *writer = new output_writer_t;
+    writer->fsync_policy = fsync_policy;
+    writer->binary = binary;
+    writer->fds = vector<int>(requested_files.size(), -1);
+    writer->progress_fds = vector<int>(requested_files.size(), -1);
+    writer->have = have;
+
+    for (int i = 0; i < (int) requested_files.size(); i++) {
+        if (requested_files[i] == 0) {
+            continue;
+        }
+
+        string filename = output_file_name(rank, i);
+
+        writer->fds[i] = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+
+        if (writer->fds[i] < 0 || ftruncate(writer->fds[i], (off_t) file_sizes[i] * record_size(writer)) < 0) {
+            fprintf(stderr, "Nu s-a putut crea fisierul %s\n", filename.c_str());
+            exit(-1);
+        }
+
+        writer->progress_fds[i] = create_progress_file(rank, i, file_sizes[i], fingerprints[i], binary, have[i]);
+    }
+
+    pthread_mutex_init(&writer->mutex, NULL);
+    pthread_cond_init(&writer->job_ready, NULL);
+
+    int r = pthread_create(&writer->thread, NULL, output_writer_func, (void *) writer);
+    if (r) {
+        printf("Eroare la crearea thread-ului de scriere\n");
+        exit(-1);
+    }
+
+    return writer;
+}
+
+
+/**
+ * Queues the hashes of a reply to be written at their offsets.
+*/
+void write_segments(output_writer_t *writer, const hash_reply_t& hashes) {
+    write_job_t job;
+    job.kind = WRITE_SEGMENTS;
+    job.hashes = hashes;
+
+    push_job(writer, job);
+}
+
+
+/**
+ * Queues the closing of a file whose segments were all queued, flushed to disk
+ * first unless the policy is FSYNC_NONE.
+*/
+void complete_output_file(output_writer_t *writer, int file_index) {
+    write_job_t job;
+    job.kind = WRITE_FILE_COMPLETE;
+    job.hashes.file_index = file_index;
+
+    push_job(writer, job);
+}
+
+
+/**
+ * Waits for the queued writes, stops the writer thread and frees the writer.
+*/
+void destroy_output_writer(output_writer_t *writer) {
+    write_job_t job;
+    job.kind = WRITE_STOP;
+
+    push_job(writer, job);
+    pthread_join(writer->thread, NULL);
+
+    for (int i = 0; i < (int) writer->fds.size(); i++) {
+        if (writer->fds[i] >= 0) {
+            close(writer->fds[i]);
+            close(writer->progress_fds[i]);
+        }
+    }
+
+    pthread_cond_destroy(&writer->job_ready);
+    pthread_mutex_destroy(&writer->mutex);
+    delete writer;
+}
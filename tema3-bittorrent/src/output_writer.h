@@ -0,0 +1,62 @@
+#ifndef OUTPUT_WRITER_H
+#define OUTPUT_WRITER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <deque>
+#include <vector>
+
+#include "bitset.h"
+#include "messages.h"
+
+// When the writer flushes an output file to disk: never (the system decides),
+// once the file is complete, or after every batch of segments written to it.
+// Except with FSYNC_NONE, the hashes of a batch are also flushed before its
+// progress is recorded, so a checkpoint survives a crash of the system.
+#define FSYNC_NONE 0
+#define FSYNC_FILE 1
+#define FSYNC_ALWAYS 2
+
+// Work for the writer thread.
+#define WRITE_SEGMENTS 0
+#define WRITE_FILE_COMPLETE 1
+#define WRITE_STOP 2
+
+typedef struct {
+    int kind;
+
+    // The hashes to write, as they arrived from a peer. Only the file index for WRITE_FILE_COMPLETE.
+    hash_reply_t hashes;
+} write_job_t;
+
+// Writes the downloaded hashes into the output files from its own thread. Each
+// requested file is created at its final size when the writer starts, and every
+// segment is written at its own offset as soon as it arrives, so the download
+// thread never waits for the disk and a partial file has every received segment.
+// The progress file of each output (checkpoint.h) is updated after the hashes.
+typedef struct {
+    int fsync_policy;
+    bool binary;
+
+    // File descriptors of the output and of the progress of each file, -1 if it isn't requested.
+    std::vector<int> fds;
+    std::vector<int> progress_fds;
+
+    // The segments written to each output file.
+    std::vector<std::vector<bitset_word_t>> have;
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t job_ready;
+    std::deque<write_job_t> jobs;
+} output_writer_t;
+
+int find_fsync_policy(const char *name);
+output_writer_t *create_output_writer(int rank, const std::vector<int>& file_sizes, const std::vector<uint64_t>& fingerprints,
+                                      const std::vector<int>& requested_files, const std::vector<std::vector<bitset_word_t>>& have,
+                                      int fsync_policy, bool binary);
+void write_segments(output_writer_t *writer, const hash_reply_t& hashes);
+void complete_output_file(output_writer_t *writer, int file_index);
+void destroy_output_writer(output_writer_t *writer);
+
+#endif
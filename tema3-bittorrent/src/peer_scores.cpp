@@ -0,0 +1,121 @@
+#include "peer_scores.h"
+#include <stdlib.h>
+
+using namespace std;
+
+
+/**
+ * Creates the scores for num_clients clients, with no measurements yet.
+*/
+peer_scores_t create_peer_scores(int num_clients) {
+    peer_scores_t scores;
+
+    scores.rtt = vector<double>(num_clients, 0);
+    scores.num_samples = vector<int>(num_clients, 0);
+    scores.outstanding = vector<int>(num_clients, 0);
+
+    return scores;
+}
+
+
+/**
+ * Records a request sent to a client.
+*/
+void start_peer_request(peer_scores_t& scores, int client) {
+    scores.outstanding[client]++;
+}
+
+
+/**
+ * Records the reply to a request and its round-trip time, negative for a request
+ * that was cancelled before it was sent.
+*/
+void finish_peer_request(peer_scores_t& scores, int client, double rtt) {
+    scores.outstanding[client]--;
+
+    if (rtt < 0) {
+        return;
+    }
+
+    if (scores.num_samples[client] == 0) {
+        scores.rtt[client] = rtt;
+    } else {
+        scores.rtt[client] += RTT_SMOOTHING * (rtt - scores.rtt[client]);
+    }
+
+    scores.num_samples[client]++;
+}
+
+
+/**
+ * Estimates how long a new request to a client would take: its round-trip time
+ * for every request already waiting there, plus the new one. Clients that were
+ * never measured get the best known time, so they are tried early.
+*/
+static double expected_time(const peer_scores_t& scores, int client, double best_rtt) {
+    double rtt = scores.num_samples[client] > 0 ? scores.rtt[client] : best_rtt;
+
+    return (scores.outstanding[client] + 1) * rtt;
+}
+
+
+/**
+ * Selects the client to ask for a segment, out of the ones that have it, other
+ * than self and exclude (-1 for none). Picks the one expected to answer first, or
+ * with two_choices, the better of two random holders. Returns the client index,
+ * or -1 if no one else has it.
+*/
+int select_peer(const peer_scores_t& scores, const swarm_t& swarm, int segment, int self, int exclude, bool two_choices, unsigned int *seed) {
+    vector<int> holders;
+    double best_rtt = 0;
+    bool measured = false;
+
+    for (int j = 0; j < swarm.num_clients; j++) {
+        if (j != self && j != exclude && has_segment(swarm, j, segment)) {
+            holders.push_back(j);
+
+            if (scores.num_samples[j] > 0 && (!measured || scores.rtt[j] < best_rtt)) {
+                best_rtt = scores.rtt[j];
+                measured = true;
+            }
+        }
+    }
+
+    if (holders.empty()) {
+        return -1;
+    }
+
+    // Nothing measured yet, compare the clients by load only.
+    if (!measured) {
+        best_rtt = 1;
+    }
+
+    // Two distinct holders: the second index is drawn from the others, past the first.
+    if (two_choices && holders.size() >= 2) {
+        int first_index = rand_r(seed) % holders.size();
+        int second_index = rand_r(seed) % (holders.size() - 1);
+
+        if (second_index >= first_index) {
+            second_index++;
+        }
+
+        int first = holders[first_index];
+        int second = holders[second_index];
+
+        return expected_time(scores, second, best_rtt) < expected_time(scores, first, best_rtt) ? second : first;
+    }
+
+    // Start the search at a random holder, so that ties don't always go to the lowest rank.
+    int start = rand_r(seed) % holders.size();
+    int best = holders[start];
+
+    for (size_t k = 1; k < holders.size(); k++) {
+        int client = holders[(start + k) % holders.size()];
+
+        if (expected_time(scores, client, best_rtt) < expected_time(scores, best, best_rtt)) {
+            best = client;
+        }
+    }
+
+    return best;
+}
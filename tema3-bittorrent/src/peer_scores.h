@@ -0,0 +1,27 @@
+#ifndef PEER_SCORES_H
+#define PEER_SCORES_H
+
+#include <vector>
+
+#include "swarm.h"
+
+// Weight of a new round-trip time sample in the moving average.
+#define RTT_SMOOTHING 0.25
+
+typedef struct {
+    // Moving average of the round-trip time of a segment request to each client, in seconds.
+    std::vector<double> rtt;
+
+    // Number of round-trip times measured for each client.
+    std::vector<int> num_samples;
+
+    // Requests sent to each client that weren't answered yet.
+    std::vector<int> outstanding;
+} peer_scores_t;
+
+peer_scores_t create_peer_scores(int num_clients);
+void start_peer_request(peer_scores_t& scores, int client);
+void finish_peer_request(peer_scores_t& scores, int client, double rtt);
+int select_peer(const peer_scores_t& scores, const swarm_t& swarm, int segment, int self, int exclude, bool two_choices, unsigned int *seed);
+
+#endif
@@ -0,0 +1,103 @@
+#include "piece_picker.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const piece_picker_t piece_pickers[] = {
+    {"sequential", pick_sequential},
+    {"rarest", pick_rarest_first},
+    {"random", pick_random_first},
+};
+
+
+/**
+ * Picks the candidate with the lowest index.
+*/
+int pick_sequential(const swarm_t& swarm, const bitset_word_t *candidates, int num_have, unsigned int *seed) {
+    return find_first_set(candidates, swarm.num_words);
+}
+
+
+/**
+ * Picks the candidate that the fewest clients have. Ties are broken at random,
+ * so that peers seeing the same swarm don't all ask for the same segment.
+*/
+int pick_rarest_first(const swarm_t& swarm, const bitset_word_t *candidates, int num_have, unsigned int *seed) {
+    int best_segment = -1;
+    int best_holders = 0;
+    int num_ties = 0;
+
+    for (int w = 0; w < swarm.num_words; w++) {
+        bitset_word_t word = candidates[w];
+
+        while (word != 0) {
+            int segment = w * BITS_PER_WORD + __builtin_ctzll(word);
+            int holders = swarm.holders[segment];
+            word &= word - 1;
+
+            if (best_segment == -1 || holders < best_holders) {
+                best_segment = segment;
+                best_holders = holders;
+                num_ties = 1;
+            } else if (holders == best_holders) {
+                // Keep each of the tied segments with the same probability.
+                num_ties++;
+                if (rand_r(seed) % num_ties == 0) {
+                    best_segment = segment;
+                }
+            }
+        }
+    }
+
+    return best_segment;
+}
+
+
+/**
+ * Picks a random candidate for the first RANDOM_FIRST_SEGMENTS segments of a
+ * file, so the client quickly has something to share, then rarest-first.
+*/
+int pick_random_first(const swarm_t& swarm, const bitset_word_t *candidates, int num_have, unsigned int *seed) {
+    if (num_have >= RANDOM_FIRST_SEGMENTS) {
+        return pick_rarest_first(swarm, candidates, num_have, seed);
+    }
+
+    int num_candidates = count_bits(candidates, swarm.num_words);
+    if (num_candidates == 0) {
+        return -1;
+    }
+
+    // Skip a random number of candidates.
+    int skip = rand_r(seed) % num_candidates;
+
+    for (int w = 0; w < swarm.num_words; w++) {
+        int in_word = __builtin_popcountll(candidates[w]);
+
+        if (skip >= in_word) {
+            skip -= in_word;
+            continue;
+        }
+
+        bitset_word_t word = candidates[w];
+        for (int k = 0; k < skip; k++) {
+            word &= word - 1;
+        }
+
+        return w * BITS_PER_WORD + __builtin_ctzll(word);
+    }
+
+    return -1;
+}
+
+
+/**
+ * Returns the piece picker with the given name, or NULL if there is none.
+*/
+const piece_picker_t *find_piece_picker(const char *name) {
+    for (const piece_picker_t& picker : piece_pickers) {
+        if (strcmp(picker.name, name) == 0) {
+            return &picker;
+        }
+    }
+
+    return NULL;
+}
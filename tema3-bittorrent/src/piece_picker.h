@@ -0,0 +1,26 @@
+#ifndef PIECE_PICKER_H
+#define PIECE_PICKER_H
+
+#include "bitset.h"
+#include "swarm.h"
+
+// Segments a client picks at random before random-first switches to rarest-first.
+#define RANDOM_FIRST_SEGMENTS 4
+
+// Chooses which of the candidate segments of a file to request next. Returns
+// a segment whose bit is set in candidates, or -1 if there is none. num_have
+// is how many segments of the file the client already has, seed belongs to
+// the calling thread.
+typedef int (*pick_segment_func)(const swarm_t& swarm, const bitset_word_t *candidates, int num_have, unsigned int *seed);
+
+typedef struct {
+    const char *name;
+    pick_segment_func pick;
+} piece_picker_t;
+
+int pick_sequential(const swarm_t& swarm, const bitset_word_t *candidates, int num_have, unsigned int *seed);
+int pick_rarest_first(const swarm_t& swarm, const bitset_word_t *candidates, int num_have, unsigned int *seed);
+int pick_random_first(const swarm_t& swarm, const bitset_word_t *candidates, int num_have, unsigned int *seed);
+const piece_picker_t *find_piece_picker(const char *name);
+
+#endif
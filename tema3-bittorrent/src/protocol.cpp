@@ -0,0 +1,311 @@
+#include "protocol.h"
+#include <algorithm>
+
+#include "config.h"
+
+using namespace std;
+
+// Number of messages sent to each tracker by send_tracker_message(), announced in the
+// done message. Only the download thread of a client sends to the trackers.
+static vector<int> messages_sent;
+
+
+/**
+ * Returns the rank of the tracker that keeps the swarm of a file.
+*/
+int file_tracker(int file_index) {
+    return file_index % config.num_trackers;
+}
+
+
+/**
+ * Converts the rank of a client to its index in the swarms.
+*/
+int rank_to_client(int rank) {
+    return rank - config.num_trackers;
+}
+
+
+/**
+ * Converts the index of a client in the swarms to its rank.
+*/
+int client_to_rank(int client) {
+    return client + config.num_trackers;
+}
+
+
+/**
+ * Returns the size of the largest message, in ints, when a TRACKER_HAVE message
+ * carries at most have_batch_size segments.
+*/
+int max_tracker_message_size(int have_batch_size) {
+    return max(3, 2 + 2 * have_batch_size);
+}
+
+
+/**
+ * Appends a 64-bit value as two ints, the low half first.
+*/
+static void push_word(vector<int>& buffer, uint64_t word) {
+    buffer.push_back((uint32_t) word);
+    buffer.push_back((uint32_t) (word >> 32));
+}
+
+
+/**
+ * Reads a 64-bit value written by push_word().
+*/
+static uint64_t read_word(const int *buffer) {
+    return (uint64_t) (uint32_t) buffer[0] | (uint64_t) (uint32_t) buffer[1] << 32;
+}
+
+
+/**
+ * Encodes the inventory of a client.
+*/
+vector<int> encode_inventory(const inventory_t& inventory) {
+    vector<int> buffer;
+
+    buffer.push_back(inventory.file_sizes.size());
+    buffer.insert(buffer.end(), inventory.file_sizes.begin(), inventory.file_sizes.end());
+
+    for (int i = 0; i < (int) inventory.file_sizes.size(); i++) {
+        if (inventory.file_sizes[i] != 0) {
+            push_word(buffer, inventory.fingerprints[i]);
+        }
+    }
+
+    for (int i = 0; i < (int) inventory.partial_files.size(); i++) {
+        if (inventory.partial_files[i].empty()) {
+            continue;
+        }
+
+        buffer.push_back(i);
+        buffer.push_back(inventory.partial_sizes[i]);
+        push_word(buffer, inventory.partial_fingerprints[i]);
+
+        for (bitset_word_t word : inventory.partial_files[i]) {
+            push_word(buffer, word);
+        }
+    }
+
+    return buffer;
+}
+
+
+/**
+ * Reads an inventory written by encode_inventory(). Returns false if it is malformed.
+*/
+bool decode_inventory(const int *buffer, int size, inventory_t& inventory) {
+    if (size < 1 || buffer[0] < 0 || buffer[0] > size - 1) {
+        return false;
+    }
+
+    inventory.file_sizes.assign(buffer + 1, buffer + 1 + buffer[0]);
+    inventory.fingerprints.assign(buffer[0], 0);
+    inventory.partial_files.clear();
+    inventory.partial_sizes.clear();
+    inventory.partial_fingerprints.clear();
+
+    int position = 1 + buffer[0];
+
+    for (int i = 0; i < (int) inventory.file_sizes.size(); i++) {
+        if (inventory.file_sizes[i] == 0) {
+            continue;
+        }
+
+        if (size - position < 2) {
+            return false;
+        }
+
+        inventory.fingerprints[i] = read_word(buffer + position);
+        position += 2;
+    }
+
+    while (position < size) {
+        if (size - position < 4 || buffer[position] < 0 || buffer[position + 1] <= 0) {
+            return false;
+        }
+
+        int file_index = buffer[position];
+        int num_segments = buffer[position + 1];
+        int num_words = BITSET_WORDS(num_segments);
+        uint64_t fingerprint = read_word(buffer + position + 2);
+        position += 4;
+
+        if ((size - position) / 2 < num_words) {
+            return false;
+        }
+
+        if (file_index >= (int) inventory.partial_files.size()) {
+            inventory.partial_files.resize(file_index + 1);
+            inventory.partial_sizes.resize(file_index + 1, 0);
+            inventory.partial_fingerprints.resize(file_index + 1, 0);
+        }
+
+        inventory.partial_sizes[file_index] = num_segments;
+        inventory.partial_fingerprints[file_index] = fingerprint;
+        inventory.partial_files[file_index].resize(num_words);
+
+        for (int w = 0; w < num_words; w++) {
+            inventory.partial_files[file_index][w] = read_word(buffer + position);
+            position += 2;
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * Startup handshake, called by all the ranks in the same order: gathers the
+ * inventories of all the ranks at the root with MPI_Gatherv, after their sizes.
+ * At the root, inventories[r] gets the inventory of rank r, elsewhere it stays empty.
+*/
+void gather_inventories(const vector<int>& inventory, int root, vector<vector<int>>& inventories) {
+    int rank, num_ranks;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
+
+    int size = inventory.size();
+    vector<int> sizes(rank == root ? num_ranks : 0);
+    vector<int> offsets(sizes.size());
+
+    MPI_Gather(&size, 1, MPI_INT, sizes.data(), 1, MPI_INT, root, MPI_COMM_WORLD);
+
+    int total_size = 0;
+
+    for (int r = 0; r < (int) sizes.size(); r++) {
+        offsets[r] = total_size;
+        total_size += sizes[r];
+    }
+
+    vector<int> buffer(total_size);
+
+    MPI_Gatherv(inventory.data(), size, MPI_INT, buffer.data(), sizes.data(), offsets.data(), MPI_INT, root, MPI_COMM_WORLD);
+
+    inventories.clear();
+
+    for (int r = 0; r < (int) sizes.size(); r++) {
+        inventories.push_back(vector<int>(buffer.begin() + offsets[r], buffer.begin() + offsets[r] + sizes[r]));
+    }
+}
+
+
+/**
+ * Sends the table of file sizes and fingerprints from the root to all the ranks
+ * with MPI_Bcast, the number of files first.
+*/
+void broadcast_file_sizes(vector<int>& file_sizes, vector<uint64_t>& fingerprints, int root) {
+    int num_files = file_sizes.size();
+    MPI_Bcast(&num_files, 1, MPI_INT, root, MPI_COMM_WORLD);
+
+    file_sizes.resize(num_files);
+    fingerprints.resize(num_files);
+    MPI_Bcast(file_sizes.data(), num_files, MPI_INT, root, MPI_COMM_WORLD);
+    MPI_Bcast(fingerprints.data(), num_files, MPI_UINT64_T, root, MPI_COMM_WORLD);
+}
+
+
+/**
+ * Encodes a message as ints.
+*/
+vector<int> encode_tracker_message(const tracker_message_t& message) {
+    vector<int> buffer;
+
+    buffer.push_back(PROTOCOL_VERSION << 16 | message.kind);
+
+    switch (message.kind) {
+    case TRACKER_PEERS_REQUEST:
+        buffer.push_back(message.file_index);
+        buffer.push_back(message.version);
+        break;
+    case TRACKER_FILE_COMPLETE:
+        buffer.push_back(message.file_index);
+        break;
+    case TRACKER_HAVE:
+        buffer.reserve(2 + 2 * message.segments.size());
+        buffer.push_back(message.segments.size());
+
+        for (auto& segment : message.segments) {
+            buffer.push_back(segment.first);
+            buffer.push_back(segment.second);
+        }
+        break;
+    case TRACKER_DONE:
+        buffer.push_back(message.count);
+        break;
+    }
+
+    return buffer;
+}
+
+
+/**
+ * Reads a message written by encode_tracker_message(). Returns false if it
+ * was written by another version of the protocol or is malformed.
+*/
+bool decode_tracker_message(const int *buffer, int size, tracker_message_t& message) {
+    if (size < 1 || buffer[0] >> 16 != PROTOCOL_VERSION) {
+        return false;
+    }
+
+    message.kind = buffer[0] & 0xffff;
+
+    switch (message.kind) {
+    case TRACKER_PEERS_REQUEST:
+        if (size != 3) {
+            return false;
+        }
+        message.file_index = buffer[1];
+        message.version = buffer[2];
+        return true;
+    case TRACKER_FILE_COMPLETE:
+        if (size != 2) {
+            return false;
+        }
+        message.file_index = buffer[1];
+        return true;
+    case TRACKER_HAVE:
+        if (size < 2 || size != 2 + 2 * buffer[1]) {
+            return false;
+        }
+        message.segments.clear();
+        for (int i = 0; i < buffer[1]; i++) {
+            message.segments.push_back(make_pair(buffer[2 + 2 * i], buffer[3 + 2 * i]));
+        }
+        return true;
+    case TRACKER_DONE:
+        if (size != 2 || buffer[1] < 0) {
+            return false;
+        }
+        message.count = buffer[1];
+        return true;
+    }
+
+    return false;
+}
+
+
+/**
+ * Encodes a message and sends it, with its kind as the tag, and counts it.
+*/
+void send_tracker_message(const tracker_message_t& message, int destination) {
+    vector<int> buffer = encode_tracker_message(message);
+
+    MPI_Ssend(&buffer[0], buffer.size(), MPI_INT, destination, message.kind, MPI_COMM_WORLD);
+
+    if (destination >= (int) messages_sent.size()) {
+        messages_sent.resize(destination + 1, 0);
+    }
+
+    messages_sent[destination]++;
+}
+
+
+/**
+ * Returns the number of messages sent to a tracker so far.
+*/
+int tracker_messages_sent(int destination) {
+    return destination < (int) messages_sent.size() ? messages_sent[destination] : 0;
+}
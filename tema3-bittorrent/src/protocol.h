@@ -0,0 +1,82 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <mpi.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include "bitset.h"
+
+// Version of the tracker message format. Every message starts with
+// (PROTOCOL_VERSION << 16 | kind), followed by the fields of that kind.
+#define PROTOCOL_VERSION 3
+
+// The first config.num_trackers ranks are trackers, each one keeps the swarms
+// of the files that file_tracker() maps to it. The others are clients.
+
+// Messages sent to the tracker, the kind is also the MPI tag.
+// Fields after the first int:
+#define TRACKER_PEERS_REQUEST 3  // file_index, version of the swarm view
+#define TRACKER_FILE_COMPLETE 6  // file_index
+#define TRACKER_HAVE 7           // n, then n (file_index, segment_index) pairs
+#define TRACKER_DONE 8           // number of messages sent to this tracker before it
+
+// Termination: a client that finished its downloads sends TRACKER_DONE to every
+// tracker, and sends them nothing afterwards. A tracker stops once it has the done
+// message of every client and as many other messages from each as it announced,
+// in whatever order they arrived. Tag 9 is no longer used.
+
+// Sent by a tracker to a client that keeps a view of the swarm of a file, when the
+// swarm changed since the client's last tag 3 request: the file_index, as MPI_UINT64_T.
+// An empty message at shutdown means the tracker sends no more of them.
+#define TRACKER_INVALIDATE 10
+
+// The inventory a client contributes to the startup handshake, as ints: the number
+// of file sizes, the sizes (0 for the files it doesn't have), the fingerprint of each
+// file it has (file_fingerprint() from hash_store.h), then for each checkpoint its
+// file index, the number of segments and the fingerprint of the file it was made
+// for, and its have bitset. 64-bit values are two ints (low half first). Every
+// tracker gathers the inventories of all the ranks (the trackers' are empty), then
+// tracker 0 broadcasts the merged file sizes and fingerprints.
+
+typedef struct {
+    int kind;
+    int file_index;
+    int version;
+
+    // Messages the client sent to the tracker before a TRACKER_DONE message.
+    int count;
+
+    // (file_index, segment_index) pairs of a TRACKER_HAVE message.
+    std::vector<std::pair<int, int>> segments;
+} tracker_message_t;
+
+typedef struct {
+    // file_sizes[i] is the number of segments of file i the client has, 0 if it
+    // doesn't have it, and fingerprints[i] the fingerprint of its hashes.
+    std::vector<int> file_sizes;
+    std::vector<uint64_t> fingerprints;
+
+    // partial_files[i] is the have bitset of the checkpoint of file i, empty if there
+    // is none, made for a file of partial_sizes[i] segments with partial_fingerprints[i].
+    // It only counts if the swarm's file has the same size and fingerprint.
+    std::vector<std::vector<bitset_word_t>> partial_files;
+    std::vector<int> partial_sizes;
+    std::vector<uint64_t> partial_fingerprints;
+} inventory_t;
+
+int file_tracker(int file_index);
+int rank_to_client(int rank);
+int client_to_rank(int client);
+int max_tracker_message_size(int have_batch_size);
+std::vector<int> encode_inventory(const inventory_t& inventory);
+bool decode_inventory(const int *buffer, int size, inventory_t& inventory);
+void gather_inventories(const std::vector<int>& inventory, int root, std::vector<std::vector<int>>& inventories);
+void broadcast_file_sizes(std::vector<int>& file_sizes, std::vector<uint64_t>& fingerprints, int root);
+std::vector<int> encode_tracker_message(const tracker_message_t& message);
+bool decode_tracker_message(const int *buffer, int size, tracker_message_t& message);
+void send_tracker_message(const tracker_message_t& message, int destination);
+int tracker_messages_sent(int destination);
+
+#endif
@@ -0,0 +1,131 @@
+#include "request_queue.h"
+#include <errno.h>
+#include <sched.h>
+
+using namespace std;
+
+
+/**
+ * Creates a queue that holds at least min_capacity requests (rounded up to a power of two).
+ * The capacity is at least 2, with a single cell a push one lap ahead would look like a free cell.
+*/
+request_queue_t *create_request_queue(int min_capacity) {
+    size_t capacity = 2;
+    while (capacity < (size_t) min_capacity) {
+        capacity *= 2;
+    }
+
+    request_queue_t *queue = new request_queue_t;
+    queue->mask = capacity - 1;
+    queue->cells = new request_queue_cell_t[capacity];
+
+    for (size_t i = 0; i < capacity; i++) {
+        queue->cells[i].sequence.store(i, memory_order_relaxed);
+    }
+
+    queue->head.store(0, memory_order_relaxed);
+    queue->tail.store(0, memory_order_relaxed);
+    sem_init(&queue->num_requests, 0, 0);
+    sem_init(&queue->num_free, 0, capacity);
+
+    return queue;
+}
+
+
+/**
+ * Frees a queue created by create_request_queue().
+*/
+void destroy_request_queue(request_queue_t *queue) {
+    sem_destroy(&queue->num_requests);
+    sem_destroy(&queue->num_free);
+    delete[] queue->cells;
+    delete queue;
+}
+
+
+/**
+ * Adds a request to the queue, in a cell reserved with the free cells semaphore.
+*/
+static void push_reserved_request(request_queue_t *queue, const upload_request_t& request) {
+    size_t position = queue->head.load(memory_order_relaxed);
+
+    while (true) {
+        request_queue_cell_t *cell = &queue->cells[position & queue->mask];
+        size_t sequence = cell->sequence.load(memory_order_acquire);
+        long difference = (long) sequence - (long) position;
+
+        if (difference == 0) {
+            // The cell is free, try to claim it.
+            if (queue->head.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                cell->request = request;
+                cell->sequence.store(position + 1, memory_order_release);
+                sem_post(&queue->num_requests);
+                return;
+            }
+        } else if (difference < 0) {
+            // The semaphore guarantees a free cell, the consumer of the one a lap ago is still reading it.
+            sched_yield();
+            position = queue->head.load(memory_order_relaxed);
+        } else {
+            // Another producer claimed the cell first.
+            position = queue->head.load(memory_order_relaxed);
+        }
+    }
+}
+
+
+/**
+ * Adds a request to the queue. Returns false if the queue is full.
+*/
+bool try_push_request(request_queue_t *queue, const upload_request_t& request) {
+    if (sem_trywait(&queue->num_free) != 0) {
+        return false;
+    }
+
+    push_reserved_request(queue, request);
+    return true;
+}
+
+
+/**
+ * Adds a request to the queue, sleeping while it is full.
+*/
+void push_request(request_queue_t *queue, const upload_request_t& request) {
+    while (sem_wait(&queue->num_free) != 0 && errno == EINTR) {
+    }
+
+    push_reserved_request(queue, request);
+}
+
+
+/**
+ * Removes the oldest request from the queue, sleeping while the queue is empty.
+*/
+upload_request_t pop_request(request_queue_t *queue) {
+    sem_wait(&queue->num_requests);
+
+    size_t position = queue->tail.load(memory_order_relaxed);
+
+    while (true) {
+        request_queue_cell_t *cell = &queue->cells[position & queue->mask];
+        size_t sequence = cell->sequence.load(memory_order_acquire);
+        long difference = (long) sequence - (long) (position + 1);
+
+        if (difference == 0) {
+            // The cell holds a request, try to claim it.
+            if (queue->tail.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                upload_request_t request = cell->request;
+                cell->sequence.store(position + queue->mask + 1, memory_order_release);
+                sem_post(&queue->num_free);
+                return request;
+            }
+        } else if (difference < 0) {
+            // The semaphore guarantees a request, the producer is still writing it.
+            sched_yield();
+            position = queue->tail.load(memory_order_relaxed);
+        } else {
+            // Another consumer took the request first.
+            position = queue->tail.load(memory_order_relaxed);
+        }
+    }
+}
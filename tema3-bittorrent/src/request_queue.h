@@ -0,0 +1,42 @@
+#ifndef REQUEST_QUEUE_H
+#define REQUEST_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <semaphore.h>
+
+// A segment request received by the upload thread, segments is the batch of a peer_message_t.
+typedef struct {
+    int client_rank;
+    int file_index;
+    int segment_index;
+    uint64_t segments;
+} upload_request_t;
+
+typedef struct {
+    std::atomic<size_t> sequence;
+    upload_request_t request;
+} request_queue_cell_t;
+
+// Bounded multi-producer multi-consumer queue, lock-free on push and pop.
+// Each cell has a sequence number that tells whose turn it is to use it,
+// so producers and consumers only contend on the head and tail counters.
+// The semaphores count the queued requests and the free cells, so that consumers
+// can sleep while it is empty and producers while it is full.
+typedef struct {
+    size_t mask;
+    request_queue_cell_t *cells;
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+    sem_t num_requests;
+    sem_t num_free;
+} request_queue_t;
+
+request_queue_t *create_request_queue(int min_capacity);
+void destroy_request_queue(request_queue_t *queue);
+bool try_push_request(request_queue_t *queue, const upload_request_t& request);
+void push_request(request_queue_t *queue, const upload_request_t& request);
+upload_request_t pop_request(request_queue_t *queue);
+
+#endif
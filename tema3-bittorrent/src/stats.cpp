@@ -0,0 +1,335 @@
+#include "stats.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Set between start_stats() and stop_stats(), the threads registered in between,
+// and the file they are written to.
+static bool enabled = false;
+static int stats_rank;
+static string stats_file;
+static uint64_t start_time;
+static vector<thread_stats_t *> registered;
+static pthread_mutex_t registered_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// The signal handler posts the semaphore, the dumper thread waits on it and writes the file.
+static sem_t dump_requests;
+static pthread_t dumper;
+static atomic<bool> stopping;
+
+
+/**
+ * Returns the time from a monotonic clock, in nanoseconds.
+*/
+static uint64_t now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+
+/**
+ * Adds to a counter only its owner thread changes.
+*/
+static void bump(atomic<uint64_t>& counter, uint64_t value) {
+    counter.store(counter.load(memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+
+/**
+ * Returns the bucket of a value: the value itself if it is small, else the position
+ * of its highest bit, followed by the HISTOGRAM_SUB_BITS bits after it.
+*/
+static int bucket_index(uint64_t value) {
+    if (value < (1 << HISTOGRAM_SUB_BITS)) {
+        return value;
+    }
+
+    int magnitude = 63 - __builtin_clzll(value);
+
+    if (magnitude > HISTOGRAM_MAX_MAGNITUDE) {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+
+    int sub_bucket = (value >> (magnitude - HISTOGRAM_SUB_BITS)) & ((1 << HISTOGRAM_SUB_BITS) - 1);
+
+    return (magnitude - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS | sub_bucket;
+}
+
+
+/**
+ * Returns the highest value of a bucket.
+*/
+static uint64_t bucket_limit(int index) {
+    if (index < (1 << HISTOGRAM_SUB_BITS)) {
+        return index;
+    }
+
+    int magnitude = (index >> HISTOGRAM_SUB_BITS) + HISTOGRAM_SUB_BITS - 1;
+    uint64_t sub_bucket = index & ((1 << HISTOGRAM_SUB_BITS) - 1);
+
+    return (((uint64_t) (1 << HISTOGRAM_SUB_BITS) + sub_bucket + 1) << (magnitude - HISTOGRAM_SUB_BITS)) - 1;
+}
+
+
+/**
+ * Adds a duration to a histogram.
+*/
+static void add_to_histogram(histogram_t& histogram, uint64_t value) {
+    bump(histogram.count, 1);
+    bump(histogram.sum, value);
+    bump(histogram.buckets[bucket_index(value)], 1);
+
+    if (value > histogram.max.load(memory_order_relaxed)) {
+        histogram.max.store(value, memory_order_relaxed);
+    }
+}
+
+
+/**
+ * Writes a histogram as a JSON object: the count, and the mean, percentiles and
+ * maximum in microseconds. A percentile is the highest value of its bucket.
+*/
+static void write_histogram(FILE *file, const histogram_t& histogram) {
+    static const double percentiles[] = {50, 90, 99, 99.9};
+    static const char *percentile_names[] = {"p50", "p90", "p99", "p999"};
+
+    // The owner may add values meanwhile, the percentiles use the buckets read here.
+    vector<uint64_t> buckets(HISTOGRAM_BUCKETS);
+    uint64_t total = 0;
+
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        buckets[b] = histogram.buckets[b].load(memory_order_relaxed);
+        total += buckets[b];
+    }
+
+    uint64_t count = histogram.count.load(memory_order_relaxed);
+    uint64_t max = histogram.max.load(memory_order_relaxed);
+    double mean = count > 0 ? (double) histogram.sum.load(memory_order_relaxed) / count : 0;
+
+    fprintf(file, "{\"count\": %" PRIu64 ", \"mean_us\": %.3f", count, mean / 1000);
+
+    for (int p = 0; p < 4; p++) {
+        uint64_t rank = (uint64_t) (percentiles[p] / 100 * total + 0.999999);
+        uint64_t seen = 0;
+        uint64_t value = 0;
+
+        for (int b = 0; b < HISTOGRAM_BUCKETS && total > 0; b++) {
+            seen += buckets[b];
+
+            if (seen >= rank) {
+                value = bucket_limit(b) < max ? bucket_limit(b) : max;
+                break;
+            }
+        }
+
+        fprintf(file, ", \"%s_us\": %.3f", percentile_names[p], value / 1000.0);
+    }
+
+    fprintf(file, ", \"max_us\": %.3f}", max / 1000.0);
+}
+
+
+/**
+ * Writes the statistics of all the registered threads to the file of this rank,
+ * first to a temporary file, so a reader never sees a partial one.
+*/
+void write_stats() {
+    string temporary_file = stats_file + ".tmp";
+    FILE *file = fopen(temporary_file.c_str(), "w");
+
+    if (file == NULL) {
+        perror(temporary_file.c_str());
+        return;
+    }
+
+    double elapsed = (now() - start_time) / 1e9;
+
+    fprintf(file, "{\n  \"rank\": %d,\n  \"elapsed\": %.3f,\n  \"threads\": [", stats_rank, elapsed);
+
+    pthread_mutex_lock(&registered_mutex);
+
+    for (int t = 0; t < (int) registered.size(); t++) {
+        thread_stats_t *stats = registered[t];
+
+        fprintf(file, "%s\n    {\n      \"name\": \"%s\",\n      \"messages\": {", t > 0 ? "," : "", stats->name);
+
+        bool first = true;
+
+        for (int tag = 0; tag < STATS_TAGS; tag++) {
+            uint64_t count = stats->messages[tag].load(memory_order_relaxed);
+
+            if (count == 0) {
+                continue;
+            }
+
+            fprintf(file, "%s\n        \"%d\": {\"count\": %" PRIu64 ", \"per_second\": %.1f, \"latency\": ",
+                    first ? "" : ",", tag, count, elapsed > 0 ? count / elapsed : 0);
+            write_histogram(file, stats->latency[tag]);
+            fprintf(file, "}");
+
+            first = false;
+        }
+
+        fprintf(file, "%s},\n      \"wait\": ", first ? "" : "\n      ");
+        write_histogram(file, stats->wait);
+        fprintf(file, "\n    }");
+    }
+
+    pthread_mutex_unlock(&registered_mutex);
+
+    fprintf(file, "\n  ]\n}\n");
+    fclose(file);
+
+    if (rename(temporary_file.c_str(), stats_file.c_str()) != 0) {
+        perror(stats_file.c_str());
+    }
+}
+
+
+/**
+ * Signal handler of SIGUSR1, only wakes the dumper (sem_post is async-signal-safe).
+*/
+static void request_dump(int signal_number) {
+    sem_post(&dump_requests);
+}
+
+
+/**
+ * Thread function that writes the statistics every time SIGUSR1 arrives.
+*/
+static void *dumper_func(void *arg) {
+    while (true) {
+        while (sem_wait(&dump_requests) == -1 && errno == EINTR) {
+        }
+
+        if (stopping.load()) {
+            return NULL;
+        }
+
+        write_stats();
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Starts collecting statistics, written to <prefix><rank>.json when SIGUSR1
+ * arrives and by stop_stats(). Without it, the threads get no statistics.
+*/
+void start_stats(int rank, const char *prefix) {
+    enabled = true;
+    stats_rank = rank;
+    stats_file = string(prefix) + to_string(rank) + ".json";
+    start_time = now();
+    stopping.store(false);
+
+    sem_init(&dump_requests, 0, 0);
+
+    int r = pthread_create(&dumper, NULL, dumper_func, NULL);
+    if (r) {
+        printf("Eroare la crearea thread-ului de statistici\n");
+        exit(-1);
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_dump;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    sigaction(SIGUSR1, &action, NULL);
+}
+
+
+/**
+ * Writes the statistics one last time, once all the registered threads stopped,
+ * and frees them. SIGUSR1 is ignored afterwards.
+*/
+void stop_stats() {
+    if (!enabled) {
+        return;
+    }
+
+    signal(SIGUSR1, SIG_IGN);
+
+    write_stats();
+
+    stopping.store(true);
+    sem_post(&dump_requests);
+    pthread_join(dumper, NULL);
+
+    sem_destroy(&dump_requests);
+
+    for (thread_stats_t *stats : registered) {
+        delete stats;
+    }
+
+    registered.clear();
+    enabled = false;
+}
+
+
+/**
+ * Returns the statistics of a new thread, included in every dump from now on,
+ * or NULL if they aren't collected. Every function below accepts NULL and does nothing.
+*/
+thread_stats_t *register_thread_stats(const char *name) {
+    if (!enabled) {
+        return NULL;
+    }
+
+    thread_stats_t *stats = new thread_stats_t();
+    snprintf(stats->name, sizeof(stats->name), "%s", name);
+
+    pthread_mutex_lock(&registered_mutex);
+    registered.push_back(stats);
+    pthread_mutex_unlock(&registered_mutex);
+
+    return stats;
+}
+
+
+/**
+ * Returns the start of a measured duration, 0 without statistics so the clock isn't read.
+*/
+uint64_t stats_start(const thread_stats_t *stats) {
+    return stats != NULL ? now() : 0;
+}
+
+
+/**
+ * Counts a message with a tag, and how long it took since start.
+*/
+void record_message(thread_stats_t *stats, int tag, uint64_t start) {
+    if (stats == NULL || tag < 0 || tag >= STATS_TAGS) {
+        return;
+    }
+
+    bump(stats->messages[tag], 1);
+    add_to_histogram(stats->latency[tag], now() - start);
+}
+
+
+/**
+ * Adds the time spent waiting for messages since start.
+*/
+void record_wait(thread_stats_t *stats, uint64_t start) {
+    if (stats == NULL) {
+        return;
+    }
+
+    add_to_histogram(stats->wait, now() - start);
+}
@@ -0,0 +1,46 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <stdint.h>
+
+// Message tags counted separately, the tags of the protocol are all below it.
+#define STATS_TAGS 16
+
+// Buckets of a histogram. Durations are in nanoseconds: below 8 each value has its
+// own bucket, then every power of two [2^m, 2^(m+1)) is split into 8 equal buckets,
+// up to 2^48 ns (about 78 hours), so a value is known within 12.5%.
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_MAX_MAGNITUDE 47
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_MAGNITUDE - 1) << HISTOGRAM_SUB_BITS)
+
+// Every field has a single writer, the thread that owns it, and is read by the
+// dumper thread, so the counters are relaxed atomics that are never incremented
+// atomically, only loaded and stored: as cheap as plain integers.
+typedef struct {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+    std::atomic<uint64_t> buckets[HISTOGRAM_BUCKETS];
+} histogram_t;
+
+// Statistics of one thread, with --stats: messages[tag] counts the messages with
+// that tag the thread handled, and latency[tag] how long each took, from when the
+// thread got it until it was handled or, for a request, until the reply arrived.
+// wait is the time the thread spent blocked waiting for messages.
+typedef struct {
+    char name[32];
+    std::atomic<uint64_t> messages[STATS_TAGS];
+    histogram_t latency[STATS_TAGS];
+    histogram_t wait;
+} thread_stats_t;
+
+void start_stats(int rank, const char *prefix);
+void stop_stats();
+thread_stats_t *register_thread_stats(const char *name);
+uint64_t stats_start(const thread_stats_t *stats);
+void record_message(thread_stats_t *stats, int tag, uint64_t start);
+void record_wait(thread_stats_t *stats, uint64_t start);
+void write_stats();
+
+#endif
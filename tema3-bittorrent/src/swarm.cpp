@@ -0,0 +1,213 @@
+#include "swarm.h"
+
+using namespace std;
+
+
+/**
+ * Creates an empty swarm for a file.
+*/
+swarm_t create_swarm(int num_clients, int num_segments, int version) {
+    swarm_t swarm;
+
+    swarm.num_clients = num_clients;
+    swarm.num_segments = num_segments;
+    swarm.num_words = BITSET_WORDS(num_segments);
+    swarm.version = version;
+    swarm.history_version = version;
+    swarm.bits = vector<bitset_word_t>(num_clients * swarm.num_words, 0);
+    swarm.holders = vector<int>(num_segments, 0);
+
+    return swarm;
+}
+
+
+/**
+ * Returns the bitset of the segments a client has.
+*/
+const bitset_word_t *client_segments(const swarm_t& swarm, int client) {
+    return &swarm.bits[client * swarm.num_words];
+}
+
+
+/**
+ * Checks if a client has a segment.
+*/
+bool has_segment(const swarm_t& swarm, int client, int segment) {
+    return test_bit(client_segments(swarm, client), segment);
+}
+
+
+/**
+ * Returns the bitset of the segments that at least one client has.
+*/
+vector<bitset_word_t> available_segments(const swarm_t& swarm) {
+    vector<bitset_word_t> available(swarm.num_words, 0);
+
+    for (int j = 0; j < swarm.num_clients; j++) {
+        const bitset_word_t *segments = client_segments(swarm, j);
+
+        for (int w = 0; w < swarm.num_words; w++) {
+            available[w] |= segments[w];
+        }
+    }
+
+    return available;
+}
+
+
+/**
+ * Marks the first num_segments segments as owned by a client, without creating a new version.
+ * Used for the files the clients already have before the swarm starts.
+*/
+void seed_swarm(swarm_t& swarm, int client, int num_segments) {
+    for (int k = 0; k < num_segments; k++) {
+        if (!has_segment(swarm, client, k)) {
+            swarm.holders[k]++;
+        }
+    }
+
+    set_first_bits(&swarm.bits[client * swarm.num_words], num_segments);
+}
+
+
+/**
+ * Marks the segments set in a bitset of swarm.num_words words as owned by a client, without
+ * creating a new version. Used for the partial downloads the clients resume.
+*/
+void seed_swarm_segments(swarm_t& swarm, int client, const bitset_word_t *segments) {
+    for (int w = 0; w < swarm.num_words; w++) {
+        merge_swarm_word(swarm, client, w, segments[w]);
+    }
+}
+
+
+/**
+ * Marks the segments set in one word of a client's bitset as owned, without creating
+ * a new version. Bits past the last segment are ignored. Returns the bits that
+ * weren't set yet.
+*/
+bitset_word_t merge_swarm_word(swarm_t& swarm, int client, int word, bitset_word_t segments) {
+    bitset_word_t& bits = swarm.bits[client * swarm.num_words + word];
+    bitset_word_t added = segments & ~bits;
+
+    if (word == swarm.num_words - 1 && swarm.num_segments % BITS_PER_WORD != 0) {
+        added &= ((bitset_word_t) 1 << (swarm.num_segments % BITS_PER_WORD)) - 1;
+    }
+
+    bits |= added;
+
+    for (bitset_word_t rest = added; rest != 0; rest &= rest - 1) {
+        swarm.holders[word * BITS_PER_WORD + __builtin_ctzll(rest)]++;
+    }
+
+    return added;
+}
+
+
+/**
+ * Marks a segment as owned by a client. Returns false if the client
+ * already had it, in which case the version doesn't change.
+ * The history keeps between bits.size() and twice as many pairs, so dropping
+ * the old ones costs O(1) per added segment.
+*/
+bool add_to_swarm(swarm_t& swarm, int client, int segment) {
+    if (has_segment(swarm, client, segment)) {
+        return false;
+    }
+
+    set_bit(&swarm.bits[client * swarm.num_words], segment);
+    swarm.holders[segment]++;
+    swarm.history.push_back(make_pair(client, segment));
+    swarm.version++;
+
+    int kept = swarm.bits.size();
+
+    if ((int) swarm.history.size() >= 2 * kept) {
+        int dropped = swarm.history.size() - kept;
+
+        swarm.history.erase(swarm.history.begin(), swarm.history.begin() + dropped);
+        swarm.history_version += dropped;
+    }
+
+    return true;
+}
+
+
+/**
+ * Builds the reply for a peer whose view of the swarm is at known_version.
+ * The peer gets only the (client, segment) pairs added since then, or the
+ * full swarm if it has no view yet, if the delta would be larger or if its
+ * version is older than the history kept.
+*/
+vector<bitset_word_t> encode_swarm_reply(const swarm_t& swarm, int known_version) {
+    int num_changes = swarm.version - known_version;
+    int full_size = swarm.bits.size();
+
+    vector<bitset_word_t> reply;
+
+    if (known_version == SWARM_NO_VERSION || known_version > swarm.version || known_version < swarm.history_version ||
+        num_changes >= full_size) {
+        reply.reserve(SWARM_REPLY_HEADER_SIZE + full_size);
+        reply.push_back(swarm.version);
+        reply.push_back(SWARM_REPLY_FULL);
+        reply.push_back(full_size);
+        reply.insert(reply.end(), swarm.bits.begin(), swarm.bits.end());
+
+        return reply;
+    }
+
+    reply.reserve(SWARM_REPLY_HEADER_SIZE + num_changes);
+    reply.push_back(swarm.version);
+    reply.push_back(SWARM_REPLY_DELTA);
+    reply.push_back(num_changes);
+
+    for (int v = known_version; v < swarm.version; v++) {
+        const pair<int, int>& change = swarm.history[v - swarm.history_version];
+        reply.push_back((bitset_word_t) change.first << 32 | change.second);
+    }
+
+    return reply;
+}
+
+
+/**
+ * Updates a peer's view of the swarm with a reply built by encode_swarm_reply().
+*/
+void apply_swarm_reply(swarm_t& swarm, const vector<bitset_word_t>& reply) {
+    int version = reply[0];
+    int kind = reply[1];
+    int count = reply[2];
+    const bitset_word_t *payload = reply.data() + SWARM_REPLY_HEADER_SIZE;
+
+    if (kind == SWARM_REPLY_FULL) {
+        swarm.bits.assign(payload, payload + count);
+
+        // Count the holders again, one set bit at a time.
+        swarm.holders.assign(swarm.num_segments, 0);
+
+        for (int j = 0; j < swarm.num_clients; j++) {
+            const bitset_word_t *segments = client_segments(swarm, j);
+
+            for (int w = 0; w < swarm.num_words; w++) {
+                bitset_word_t word = segments[w];
+
+                while (word != 0) {
+                    swarm.holders[w * BITS_PER_WORD + __builtin_ctzll(word)]++;
+                    word &= word - 1;
+                }
+            }
+        }
+    } else {
+        for (int i = 0; i < count; i++) {
+            int client = payload[i] >> 32;
+            int segment = payload[i] & 0xffffffff;
+
+            if (!has_segment(swarm, client, segment)) {
+                set_bit(&swarm.bits[client * swarm.num_words], segment);
+                swarm.holders[segment]++;
+            }
+        }
+    }
+
+    swarm.version = version;
+}
@@ -0,0 +1,49 @@
+#ifndef SWARM_H
+#define SWARM_H
+
+#include <vector>
+#include <utility>
+
+#include "bitset.h"
+
+// Version of a swarm view that was never synchronized with the tracker.
+#define SWARM_NO_VERSION -1
+
+// Reply to a tag 3 request, sent as MPI_UINT64_T: [version, kind, count, payload...].
+// A full reply carries the swarm bitset, a delta reply carries (client << 32 | segment) entries.
+#define SWARM_REPLY_HEADER_SIZE 3
+#define SWARM_REPLY_DELTA 0
+#define SWARM_REPLY_FULL 1
+
+typedef struct {
+    int num_clients;
+    int num_segments;
+    int num_words;
+    int version;
+
+    // One bit per segment, the num_words words of client j start at j * num_words.
+    std::vector<bitset_word_t> bits;
+
+    // holders[k] is the number of clients that have segment k.
+    std::vector<int> holders;
+
+    // (client, segment) pairs in the order they were added, history[v - history_version]
+    // moves the swarm from version v to v+1. Only kept by the tracker, peers just apply
+    // the replies. A delta longer than the full swarm is never sent, so only the last
+    // bits.size() pairs are needed, older ones are dropped.
+    std::vector<std::pair<int, int>> history;
+    int history_version;
+} swarm_t;
+
+swarm_t create_swarm(int num_clients, int num_segments, int version);
+const bitset_word_t *client_segments(const swarm_t& swarm, int client);
+bool has_segment(const swarm_t& swarm, int client, int segment);
+std::vector<bitset_word_t> available_segments(const swarm_t& swarm);
+void seed_swarm(swarm_t& swarm, int client, int num_segments);
+void seed_swarm_segments(swarm_t& swarm, int client, const bitset_word_t *segments);
+bitset_word_t merge_swarm_word(swarm_t& swarm, int client, int word, bitset_word_t segments);
+bool add_to_swarm(swarm_t& swarm, int client, int segment);
+std::vector<bitset_word_t> encode_swarm_reply(const swarm_t& swarm, int known_version);
+void apply_swarm_reply(swarm_t& swarm, const std::vector<bitset_word_t>& reply);
+
+#endif
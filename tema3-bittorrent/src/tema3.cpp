@@ -1,18 +1,38 @@
 #include <mpi.h>
 #include <pthread.h>
+#include <atomic>
 #include <iostream>
-#include <fstream>
 #include <string>
 #include <vector>
-#include <tuple>
-
+#include <deque>
+#include <algorithm>
+
+#include "checkpoint.h"
+#include "config.h"
+#include "download_queue.h"
+#include "gossip.h"
+#include "hash_store.h"
+#include "hash_window.h"
+#include "input.h"
+#include "messages.h"
+#include "output_writer.h"
+#include "peer_scores.h"
+#include "piece_picker.h"
+#include "protocol.h"
+#include "request_queue.h"
+#include "stats.h"
+#include "swarm.h"
+#include "wake_timer.h"
+
+// The tracker that broadcasts the file sizes and stops the clients at the end.
 #define TRACKER_RANK 0
-#define MAX_FILES 10
-#define MAX_FILENAME 15
-#define HASH_SIZE 32
-#define MAX_CHUNKS 100
 
-#define MAX_FILES_BEFORE_UPDATING_TRACKER 10
+// Receives the tracker keeps posted, and replies it keeps in flight.
+#define TRACKER_RECEIVES 16
+#define TRACKER_REPLIES 64
+
+// Hash replies a single upload sender keeps in flight.
+#define MAX_PENDING_SENDS 16
 
 using namespace std;
 
@@ -21,111 +41,462 @@ typedef struct {
     int num_clients;
     vector<int> requested_files;
     vector<int> file_sizes;
+    vector<int> swarm_file_sizes;
+    vector<vector<bitset_word_t>> partial_files;
+    hash_store_t *files;
+    pthread_mutex_t *files_mutex;
+    output_writer_t *writer;
+    hash_window_t *window;
+    wake_timer_t *timer;
+    atomic<bool> *shutdown;
 } download_thread_arg_t;
 
 typedef struct {
-    int rank;
+    int worker;
+    download_queue_t *queue;
+    hash_store_t *files;
+    pthread_mutex_t *files_mutex;
+    output_writer_t *writer;
+    hash_window_t *window;
+    vector<vector<bitset_word_t>> *received;
+} download_worker_arg_t;
+
+typedef struct {
     int num_clients;
-    vector<vector<string>> files;
-    vector<int> file_sizes;
+    hash_store_t *files;
+    pthread_mutex_t *files_mutex;
+    wake_timer_t *timer;
+    atomic<bool> *shutdown;
 } upload_thread_arg_t;
 
 typedef struct {
-    int code;
-    int file_index;
-    int segment_index;
-    int files[MAX_FILES][MAX_CHUNKS];
-} tracker_message_t;
+    int sender;
+    request_queue_t *queue;
+    hash_store_t *files;
+    pthread_mutex_t *files_mutex;
+} upload_sender_arg_t;
+
+/**
+ * Asks the tracker what changed in the swarm of a file since the last request
+ * and applies the reply to the local view.
+*/
+void update_swarm_view(int file_index, swarm_t& swarm_view) {
+    tracker_message_t tracker_message;
+    tracker_message.kind = TRACKER_PEERS_REQUEST;
+    tracker_message.file_index = file_index;
+    tracker_message.version = swarm_view.version;
+
+    MPI_Status s;
+
+    int tracker_rank = file_tracker(file_index);
+
+    send_tracker_message(tracker_message, tracker_rank);
+
+    // The reply has a variable length (full swarm or only the changes).
+    int reply_size;
+    MPI_Probe(tracker_rank, TRACKER_PEERS_REQUEST, MPI_COMM_WORLD, &s);
+    MPI_Get_count(&s, MPI_UINT64_T, &reply_size);
+
+    vector<bitset_word_t> reply(reply_size);
+    MPI_Recv(&reply[0], reply_size, MPI_UINT64_T, tracker_rank, TRACKER_PEERS_REQUEST, MPI_COMM_WORLD, &s);
+
+    apply_swarm_reply(swarm_view, reply);
+}
 
-typedef struct {
-    int file_index;
-    int segment_index;
-} peer_message_t;
 
 /**
- * Converts the file name to an index.
+ * Returns the segments some peer has in the view of a swarm, that this client
+ * neither has nor waits for.
 */
-int name_to_index(string filename) {
-    string number;
+vector<bitset_word_t> missing_segments(const swarm_t& swarm_view, const vector<bitset_word_t>& have,
+                                       const vector<bitset_word_t>& in_flight) {
+    vector<bitset_word_t> segments = available_segments(swarm_view);
 
-    for (char c : filename) {
-        if (isdigit(c)) {
-            number += c;
-        }
+    for (int w = 0; w < swarm_view.num_words; w++) {
+        segments[w] &= ~have[w] & ~in_flight[w];
     }
 
-    return stoi(number) - 1;
+    return segments;
 }
 
 
 /**
- * Converts a given index to a file name.
+ * Receives the swarm changes the trackers announced and marks the views of
+ * those files stale. Returns true if there was any.
 */
-string index_to_name(int index) {
-    return "file" + to_string(index+1);
+bool receive_invalidations(vector<char>& stale, thread_stats_t *stats) {
+    bool received = false;
+    int flag;
+    MPI_Status s;
+
+    MPI_Iprobe(MPI_ANY_SOURCE, TRACKER_INVALIDATE, MPI_COMM_WORLD, &flag, &s);
+
+    while (flag) {
+        uint64_t start = stats_start(stats);
+        uint64_t file_index;
+        MPI_Recv(&file_index, 1, MPI_UINT64_T, s.MPI_SOURCE, TRACKER_INVALIDATE, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+
+        stale[file_index] = 1;
+        received = true;
+
+        record_message(stats, TRACKER_INVALIDATE, start);
+
+        MPI_Iprobe(MPI_ANY_SOURCE, TRACKER_INVALIDATE, MPI_COMM_WORLD, &flag, &s);
+    }
+
+    return received;
 }
 
 
 /**
- * Outputs the hashes of the requested files.
+ * Waits until a tracker announces a swarm change, or until the deadline, and marks
+ * the views of the files that changed stale.
 */
-void write_output_file(int rank, int file_index, int file_size, vector<string>& segments) {
+void wait_for_invalidations(vector<char>& stale, double deadline, wake_timer_t *timer, thread_stats_t *stats) {
+    uint64_t file_index;
+    MPI_Request requests[2];
+    MPI_Status s;
+    int index;
+
+    MPI_Irecv(&file_index, 1, MPI_UINT64_T, MPI_ANY_SOURCE, TRACKER_INVALIDATE, MPI_COMM_WORLD, &requests[0]);
+    start_wake_timer(timer, deadline, &requests[1]);
+
+    MPI_Waitany(2, requests, &index, &s);
 
-    string filename = "client" + to_string(rank) + "_" + index_to_name(file_index);
+    finish_wake_timer(timer, &requests[1]);
 
-    ofstream file(filename);
+    // The deadline came first, the receive may still have matched a message meanwhile.
+    if (index != 0) {
+        MPI_Cancel(&requests[0]);
+        MPI_Wait(&requests[0], &s);
+    }
+
+    int cancelled;
+    MPI_Test_cancelled(&s, &cancelled);
 
-    for (int i = 0; i < file_size; i++) {
-        file << segments[i] << "\n";
+    if (!cancelled) {
+        stale[file_index] = 1;
+        record_message(stats, TRACKER_INVALIDATE, stats_start(stats));
     }
 
-    file.close();
+    receive_invalidations(stale, stats);
 }
 
 
 /**
- * Create an MPI datatype to use when sending a tracker_message_t struct.
+ * Tells the trackers about the segments downloaded since the last update,
+ * in a single message to each tracker that keeps one of their files.
 */
-MPI_Datatype create_tracker_message_datatype() {
+void send_have_update(vector<pair<int, int>>& download_history) {
+    vector<tracker_message_t> tracker_messages(config.num_trackers);
+
+    for (auto& segment : download_history) {
+        tracker_messages[file_tracker(segment.first)].segments.push_back(segment);
+    }
 
-    MPI_Datatype tracker_message_datatype;
-    int block_lengths[4] = {1, 1, 1, MAX_FILES * MAX_CHUNKS};
-    MPI_Datatype types[4] = {MPI_INT, MPI_INT, MPI_INT, MPI_INT};
+    for (int t = 0; t < config.num_trackers; t++) {
+        if (!tracker_messages[t].segments.empty()) {
+            tracker_messages[t].kind = TRACKER_HAVE;
+            send_tracker_message(tracker_messages[t], t);
+        }
+    }
 
-    MPI_Aint offsets[4];
-    offsets[0] = offsetof(tracker_message_t, code);
-    offsets[1] = offsetof(tracker_message_t, file_index);
-    offsets[2] = offsetof(tracker_message_t, segment_index);
-    offsets[3] = offsetof(tracker_message_t, files);
+    download_history.clear();
+}
 
-    MPI_Type_create_struct(4, block_lengths, offsets, types, &tracker_message_datatype);
-    MPI_Type_commit(&tracker_message_datatype);
 
-    return tracker_message_datatype;
+/**
+ * Tells every tracker that this client finished its downloads, with the number of
+ * messages it sent to that tracker before, so it knows when it has them all.
+*/
+void send_done_messages() {
+    for (int t = 0; t < config.num_trackers; t++) {
+        tracker_message_t tracker_message;
+        tracker_message.kind = TRACKER_DONE;
+        tracker_message.count = tracker_messages_sent(t);
+
+        send_tracker_message(tracker_message, t);
+    }
 }
 
 
 /**
- * Create an MPI datatype to use when sending a peer_message_t struct.
+ * Thread function of a download worker. Takes the tasks of the download thread,
+ * asks the peers for the hashes, stores them and queues them for writing, then
+ * returns the result. Keeps as many requests in flight as it has tasks, up to
+ * config.window_size, and blocks until a hash or a new task arrives.
+ * With --rma, it reads the hashes from the peer's window instead of asking it.
+ * In the endgame, a segment may be asked from two peers: the first hash that
+ * arrives is kept, and a task whose segments all arrived is not sent anymore.
 */
-MPI_Datatype create_peer_message_datatype() {
-    MPI_Datatype peer_message_datatype;
-    int block_lengths[2] = {1, 1};
-    MPI_Datatype types[2] = {MPI_INT, MPI_INT};
+void *download_worker_func(void *arg)
+{
+    // Unpack the arguments.
+    download_worker_arg_t* worker_arg = (download_worker_arg_t*) arg;
+    int worker = worker_arg->worker;
+    download_queue_t *queue = worker_arg->queue;
+    hash_store_t& files = *worker_arg->files;
+    pthread_mutex_t *files_mutex = worker_arg->files_mutex;
+    output_writer_t *writer = worker_arg->writer;
+    hash_window_t *window = worker_arg->window;
+
+    // The segments whose hashes arrived, shared by the workers under files_mutex, NULL
+    // without the endgame, when every segment is asked only once.
+    vector<vector<bitset_word_t>> *received = worker_arg->received;
+
+    thread_stats_t *stats = register_thread_stats(("download worker " + to_string(worker)).c_str());
+
+    // The requests in flight. Slot k has its request in send_requests[k] and
+    // waits for the hash in recv_requests[k], MPI_REQUEST_NULL if the slot is free.
+    // A read from a window has only the MPI_Rget in recv_requests[k], and
+    // read_offsets[k] is the first segment read, -1 for a request to the peer.
+    // The second requests of the endgame get a second window.
+    int window_size = received != NULL ? 2 * config.window_size : config.window_size;
+    vector<peer_message_t> request_messages(window_size);
+    vector<int> request_peers(window_size);
+    vector<int> read_offsets(window_size);
+    vector<double> request_times(window_size);
+    vector<uint64_t> request_starts(window_size);
+    vector<hash_reply_t> replies(window_size);
+    vector<MPI_Request> send_requests(window_size, MPI_REQUEST_NULL);
+    vector<MPI_Request> recv_requests(window_size + 1, MPI_REQUEST_NULL);
+    int num_in_flight = 0;
+
+    // recv_requests[window_size] is the wake request, while the worker waits with room for more.
+    vector<int> completed_slots(window_size + 1);
+    vector<MPI_Status> statuses(window_size + 1);
+
+    while (true) {
+
+        // Send the tasks there is room for. With nothing in flight, wait for one.
+        download_task_t task;
+
+        while (num_in_flight < window_size &&
+               (num_in_flight == 0 ? (task = pop_task(queue, worker), true) : try_pop_task(queue, worker, task))) {
+
+            // Stop, the download thread only asks once all the results are back.
+            if (task.client_rank == -1) {
+                return NULL;
+            }
+
+            // Drop a task whose segments all arrived with other tasks while it was queued.
+            // A reply says which segments it carries, so a task is sent whole or not at all.
+            if (received != NULL) {
+                pthread_mutex_lock(files_mutex);
+                bitset_word_t new_segments = task.segments & ~(*received)[task.file_index][task.segment_index / BITS_PER_WORD];
+                pthread_mutex_unlock(files_mutex);
+
+                if (new_segments == 0) {
+                    download_result_t result;
+                    result.client = rank_to_client(task.client_rank);
+                    result.file_index = task.file_index;
+                    result.segment_index = task.segment_index;
+                    result.requested = task.segments;
+                    result.segments = 0;
+                    result.rtt = -1;
+
+                    push_result(queue, result);
+                    continue;
+                }
+            }
+
+            int slot = 0;
+            while (recv_requests[slot] != MPI_REQUEST_NULL) {
+                slot++;
+            }
+
+            MPI_Aint address = window != NULL ? remote_hash_address(window, task.client_rank, task.file_index) : 0;
+
+            if (address != 0) {
+
+                // Read the hashes from the first requested segment to the last one,
+                // into the reply, and keep only the requested ones when they arrive.
+                int first = __builtin_ctzll(task.segments);
+                int count = BITS_PER_WORD - __builtin_clzll(task.segments) - first;
+
+                replies[slot].file_index = task.file_index;
+                replies[slot].segment_index = task.segment_index;
+                replies[slot].segments = task.segments;
+
+                sync_hash_window(window);
 
-    MPI_Aint offsets[2];
-    offsets[0] = offsetof(peer_message_t, file_index);
-    offsets[1] = offsetof(peer_message_t, segment_index);
+                MPI_Rget(&replies[slot].hashes[0], count * DIGEST_SIZE, MPI_BYTE, task.client_rank,
+                         address + (MPI_Aint) (task.segment_index + first) * DIGEST_SIZE, count * DIGEST_SIZE, MPI_BYTE,
+                         window->win, &recv_requests[slot]);
 
-    MPI_Type_create_struct(2, block_lengths, offsets, types, &peer_message_datatype);
-    MPI_Type_commit(&peer_message_datatype);
+                read_offsets[slot] = first;
+            } else {
+                request_messages[slot].file_index = task.file_index;
+                request_messages[slot].segment_index = task.segment_index;
+                request_messages[slot].segments = task.segments;
 
-    return peer_message_datatype;
+                MPI_Irecv(&replies[slot], sizeof(hash_reply_t), MPI_BYTE, task.client_rank, 5, MPI_COMM_WORLD, &recv_requests[slot]);
+                MPI_Isend(&request_messages[slot], 1, datatypes.peer_message, task.client_rank, 4, MPI_COMM_WORLD, &send_requests[slot]);
+
+                read_offsets[slot] = -1;
+            }
+
+            request_peers[slot] = task.client_rank;
+            request_times[slot] = MPI_Wtime();
+            request_starts[slot] = stats_start(stats);
+            num_in_flight++;
+        }
+
+        // Wait for hashes. With room for more requests, a new task also ends the wait,
+        // and if one was queued meanwhile, it is sent first.
+        int num_requests = window_size;
+
+        if (num_in_flight < window_size) {
+            if (!start_wake_request(queue, worker, &recv_requests[window_size])) {
+                continue;
+            }
+
+            num_requests++;
+        }
+
+        uint64_t wait_start = stats_start(stats);
+
+        int num_completed;
+        MPI_Waitsome(num_requests, &recv_requests[0], &num_completed, &completed_slots[0], &statuses[0]);
+
+        record_wait(stats, wait_start);
+
+        if (num_requests > window_size) {
+            finish_wake_request(queue, worker, &recv_requests[window_size]);
+        }
+
+        for (int c = 0; c < num_completed; c++) {
+            int slot = completed_slots[c];
+
+            if (slot == window_size) {
+                continue;
+            }
+
+            MPI_Wait(&send_requests[slot], MPI_STATUS_IGNORE);
+            num_in_flight--;
+
+            // The reply says which segments it carries. Replies from the same peer
+            // may complete in any of the slots waiting on that peer, of any worker.
+            hash_reply_t& reply = replies[slot];
+
+            // A read has all the hashes from the first requested one, move the requested
+            // ones to the front. The k-th requested hash is never before position k.
+            if (read_offsets[slot] != -1) {
+                int h = 0;
+                for (bitset_word_t segments = reply.segments; segments != 0; segments &= segments - 1) {
+                    reply.hashes[h++] = reply.hashes[__builtin_ctzll(segments) - read_offsets[slot]];
+                }
+            }
+
+            // Save the received hashes, they are in the order of the segments. The ones
+            // another task brought first are dropped.
+            bitset_word_t requested = reply.segments;
+
+            pthread_mutex_lock(files_mutex);
+
+            bitset_word_t first_arrivals = reply.segments;
+
+            if (received != NULL) {
+                bitset_word_t& done = (*received)[reply.file_index][reply.segment_index / BITS_PER_WORD];
+                first_arrivals &= ~done;
+                done |= first_arrivals;
+            }
+
+            int h = 0;
+            for (bitset_word_t segments = reply.segments; segments != 0; segments &= segments - 1, h++) {
+                if (first_arrivals & segments & -segments) {
+                    segment_slot(files, reply.file_index, reply.segment_index + __builtin_ctzll(segments)) = reply.hashes[h];
+                }
+            }
+
+            pthread_mutex_unlock(files_mutex);
+
+            // The others may read these hashes once the download thread announces them.
+            sync_hash_window(window);
+
+            // Only the first arrivals are written, the file may be complete already.
+            if (first_arrivals != reply.segments) {
+                int kept = 0;
+
+                h = 0;
+                for (bitset_word_t segments = reply.segments; segments != 0; segments &= segments - 1, h++) {
+                    if (first_arrivals & segments & -segments) {
+                        reply.hashes[kept++] = reply.hashes[h];
+                    }
+                }
+
+                reply.segments = first_arrivals;
+            }
+
+            if (reply.segments != 0) {
+                write_segments(writer, reply);
+            }
+
+            download_result_t result;
+            result.client = rank_to_client(request_peers[slot]);
+            result.file_index = reply.file_index;
+            result.segment_index = reply.segment_index;
+            result.requested = requested;
+            result.segments = reply.segments;
+            result.rtt = MPI_Wtime() - request_times[slot];
+
+            push_result(queue, result);
+
+            // The hashes of a request (or of a read, with --rma), since it was sent.
+            record_message(stats, 5, request_starts[slot]);
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Stops the download workers and frees their queue.
+*/
+void stop_download_workers(download_queue_t *queue, vector<pthread_t>& workers) {
+    for (int w = 0; w < (int) workers.size(); w++) {
+        download_task_t stop_task;
+        stop_task.client_rank = -1;
+        stop_task.file_index = -1;
+        stop_task.segment_index = -1;
+        stop_task.segments = 0;
+
+        push_task(queue, w, stop_task);
+    }
+
+    for (int w = 0; w < (int) workers.size(); w++) {
+        pthread_join(workers[w], NULL);
+    }
+
+    destroy_download_queue(queue);
 }
 
 
 /**
- * Thread function that handles downloading segments from other peers. 
+ * Keeps passing on the have-bitmaps of the neighbours after this client
+ * finished its downloads, since the others may still need them, until the
+ * coordinator stops the clients. The upload thread wakes the timer then.
+*/
+void relay_gossip(gossip_t& gossip, vector<swarm_t>& swarm_views, wake_timer_t *timer, atomic<bool> *shutdown) {
+    while (!shutdown->load()) {
+        send_gossip(gossip, swarm_views);
+        wait_gossip(gossip, swarm_views, timer);
+    }
+
+    finish_gossip(gossip);
+}
+
+
+/**
+ * Thread function that handles downloading segments from other peers.
+ * Keeps up to config.window_size segment requests in flight, spread over
+ * the peers that have them, and refills the window as the hashes arrive.
+ * The requests are sent by a pool of config.download_threads workers: the
+ * tasks of file i go to the deque of worker i % config.download_threads, and
+ * idle workers steal from the others. Once at most config.endgame segments of a
+ * file are missing, the ones in flight are also asked from a second peer, in a
+ * second window, so a slow peer doesn't hold back the end of the file.
 */
 void *download_thread_func(void *arg)
 {
@@ -136,11 +507,89 @@ void *download_thread_func(void *arg)
     vector<int> requested_files = download_arg->requested_files;
     vector<int> file_sizes = download_arg->file_sizes;
 
-    // This will store downloaded hashes for each requested file.
-    vector<vector<string>> files(MAX_FILES, vector<string>(MAX_CHUNKS));
+    thread_stats_t *stats = register_thread_stats("download");
+
+    // The workers store the hashes in the files shared with the upload thread, so that
+    // downloaded segments can be served to other peers once the tracker advertises
+    // them, and queue them to the writer thread.
+    output_writer_t *writer = download_arg->writer;
+
+    // Number of files in the swarm, discovered by the trackers at startup.
+    int num_files = requested_files.size();
+
+    // Load and round-trip time of each peer, used to choose whom to ask for a segment.
+    peer_scores_t scores = create_peer_scores(num_clients);
+
+    // Strategy that orders the segments of a file, chosen with --picker.
+    const piece_picker_t *picker = find_piece_picker(config.picker);
+    unsigned int seed = rank;
+
+    // View of the swarm of each file, kept in sync with the tracker through deltas.
+    // Segments this client has downloaded (including the ones of a resumed download), and segments that were requested and
+    // whose hash hasn't arrived yet, one bitset per file. Only the requested files
+    // get storage, sized from the number of segments the trackers reported.
+    vector<swarm_t> swarm_views(num_files);
+    vector<vector<bitset_word_t>> have(num_files);
+    vector<vector<bitset_word_t>> in_flight(num_files);
+
+    // missing[i] is the number of segments of file i whose hash didn't arrive yet.
+    // In the endgame, duplicated has the segments in flight that were asked from a
+    // second peer, and requested_from[i][k] is the last client segment k was asked from.
+    vector<int> missing(num_files, 0);
+    vector<vector<bitset_word_t>> duplicated(num_files);
+    vector<vector<int>> requested_from(num_files);
+
+    // The views are cached: a view is asked again config.swarm_refresh ms after it was
+    // last asked, or sooner when it has nothing left to request and the tracker
+    // announced a change (stale). A swarm only grows, so an old view misses
+    // segments but never has wrong ones.
+    vector<char> stale(num_files, 1);
+    vector<double> refresh_times(num_files, 0);
+    double refresh_interval = config.swarm_refresh / 1000.0;
+
+    for (int i = 0; i < num_files; i++) {
+        if (requested_files[i] != 0) {
+            swarm_views[i] = create_swarm(num_clients, file_sizes[i], SWARM_NO_VERSION);
+            have[i] = download_arg->partial_files[i];
+            in_flight[i].assign(BITSET_WORDS(file_sizes[i]), 0);
+            missing[i] = file_sizes[i] - count_bits(&have[i][0], have[i].size());
+
+            if (config.endgame > 0) {
+                duplicated[i].assign(BITSET_WORDS(file_sizes[i]), 0);
+                requested_from[i].assign(file_sizes[i], -1);
+            }
+        }
+    }
+
+    // The segments whose hashes arrived, shared with the workers, which keep only the
+    // first hash of a segment that was asked twice.
+    vector<vector<bitset_word_t>> received = have;
+
+    // In gossip mode the views come from the neighbours instead of the trackers,
+    // so there is a view of every file, to pass on what the other clients have.
+    // The neighbours start with the segments of this client.
+    gossip_t gossip;
+    int self = rank_to_client(rank);
+
+    if (config.gossip > 0) {
+        for (int i = 0; i < num_files; i++) {
+            if (requested_files[i] == 0 && download_arg->swarm_file_sizes[i] != 0) {
+                swarm_views[i] = create_swarm(num_clients, download_arg->swarm_file_sizes[i], SWARM_NO_VERSION);
+            }
+        }
 
-    // ID of the client that was used for the previous hash download.
-    int previous_peer = -1;
+        gossip = create_gossip(self, num_clients, config.gossip, config.have_interval / 1000.0, swarm_views);
+
+        for (int i = 0; i < num_files; i++) {
+            for (int w = 0; w < swarm_views[i].num_words; w++) {
+                if (requested_files[i] != 0) {
+                    gossip_word(gossip, swarm_views, i, self, w, have[i][w]);
+                } else if (file_sizes[i] != 0) {
+                    gossip_word(gossip, swarm_views, i, self, w, ~(bitset_word_t) 0);
+                }
+            }
+        }
+    }
 
 
     // When a client doesn't want to download any files,
@@ -148,143 +597,366 @@ void *download_thread_func(void *arg)
     // downloading.
 
     int num_requested_files = 0;
-    for (int i = 0; i < MAX_FILES; i++) {
+    for (int i = 0; i < num_files; i++) {
         if (requested_files[i] != 0) {
             num_requested_files++;
         } 
     }
     
     if (num_requested_files == 0) {
-        tracker_message_t tracker_message;
-        tracker_message.code = 8;
 
-        // Signal the tracker that this client has finished all downloads.
-        MPI_Ssend(&tracker_message, 1, create_tracker_message_datatype(), TRACKER_RANK, 8, MPI_COMM_WORLD);
+        // Signal the trackers that this client has finished all downloads.
+        send_done_messages();
+
+        if (config.gossip > 0) {
+            relay_gossip(gossip, swarm_views, download_arg->timer, download_arg->shutdown);
+        }
+
         return NULL;
     }
 
     // Store the segment download history. First number is file_index, second is segment_index.
+    // It is sent to the tracker when it has config.have_batch_size segments, or
+    // config.have_interval milliseconds after the oldest one was downloaded.
     vector<pair<int, int>> download_history;
+    double history_deadline = 0;
+
+    // Number of requests in flight, over all the workers.
+    int window_size = config.window_size;
+    int num_in_flight = 0;
+
+    // Start the workers.
+    int num_workers = config.download_threads;
+    download_queue_t *queue = create_download_queue(num_workers);
+
+    vector<download_worker_arg_t> worker_args(num_workers);
+    vector<pthread_t> workers(num_workers);
+
+    for (int w = 0; w < num_workers; w++) {
+        worker_args[w].worker = w;
+        worker_args[w].queue = queue;
+        worker_args[w].files = download_arg->files;
+        worker_args[w].files_mutex = download_arg->files_mutex;
+        worker_args[w].writer = writer;
+        worker_args[w].window = download_arg->window;
+        worker_args[w].received = config.endgame > 0 ? &received : NULL;
+
+        int r = pthread_create(&workers[w], NULL, download_worker_func, (void *) &worker_args[w]);
+        if (r) {
+            printf("Eroare la crearea thread-ului de download\n");
+            exit(-1);
+        }
+    }
+
+    vector<download_result_t> results;
 
     while (true) {
 
-        for (int i = 0; i < MAX_FILES; i++) {
+        // Refill the window. Update the views of the incomplete files that are out
+        // of date, then take one segment per file in turn, so that all the files progress.
+        // The requests of the endgame may fill a second window.
+        bool endgame = false;
 
-            if (requested_files[i] == 0) {
-                continue;
+        for (int i = 0; i < num_files; i++) {
+            if (requested_files[i] != 0 && missing[i] <= config.endgame) {
+                endgame = true;
             }
+        }
 
+        if (num_in_flight < window_size || (endgame && num_in_flight < 2 * window_size)) {
 
-            // Request the list of peers from the tracker.
-            int peers[num_clients][MAX_CHUNKS];
-            memset(peers, 0, sizeof(peers));
+            vector<vector<bitset_word_t>> candidates(num_files);
 
-            tracker_message_t tracker_message;
-            tracker_message.code = 3;
-            tracker_message.file_index = i;
+            if (config.gossip > 0) {
+                receive_gossip(gossip, swarm_views);
+            } else {
+                receive_invalidations(stale, stats);
+            }
 
-            MPI_Status s;
+            for (int i = 0; i < num_files; i++) {
 
-            MPI_Ssend(&tracker_message, 1, create_tracker_message_datatype(), TRACKER_RANK, 3, MPI_COMM_WORLD);
-            MPI_Recv(peers, num_clients * MAX_CHUNKS, MPI_INT, TRACKER_RANK, 3, MPI_COMM_WORLD, &s);
+                if (requested_files[i] == 0) {
+                    continue;
+                }
+
+                // In gossip mode, only the neighbours update the views.
+                bool due = config.gossip == 0 && MPI_Wtime() >= refresh_times[i] + refresh_interval;
 
+                if (!due) {
+                    candidates[i] = missing_segments(swarm_views[i], have[i], in_flight[i]);
+                    due = config.gossip == 0 && stale[i] && count_bits(&candidates[i][0], candidates[i].size()) == 0;
+                }
 
-            // Find a segment that the client needs.
-            int segment_index = -1;
+                if (due) {
+                    uint64_t start = stats_start(stats);
 
-            for (int j = 0; j < file_sizes[i]; j++) {
-                if (files[i][j].size() != HASH_SIZE) {
-                    segment_index = j;
-                    break;
+                    update_swarm_view(i, swarm_views[i]);
+
+                    record_message(stats, TRACKER_PEERS_REQUEST, start);
+
+                    stale[i] = 0;
+                    refresh_times[i] = MPI_Wtime();
+
+                    candidates[i] = missing_segments(swarm_views[i], have[i], in_flight[i]);
                 }
             }
 
-            if (segment_index == -1) {
-                continue;
+            bool found = true;
+
+            while (num_in_flight < window_size && found) {
+                found = false;
+
+                for (int i = 0; i < num_files && num_in_flight < window_size; i++) {
+
+                    if (candidates[i].empty()) {
+                        continue;
+                    }
+
+                    int num_have = count_bits(&have[i][0], have[i].size());
+                    int segment_index = picker->pick(swarm_views[i], &candidates[i][0], num_have, &seed);
+
+                    if (segment_index == -1) {
+                        continue;
+                    }
+
+                    clear_bit(&candidates[i][0], segment_index);
+                    found = true;
+
+
+                    // Select the client expected to answer first, out of the ones that have this segment.
+                    int client = select_peer(scores, swarm_views[i], segment_index, self, -1, config.two_choices, &seed);
+
+                    // No other peer has it.
+                    if (client == -1) {
+                        continue;
+                    }
+
+                    int client_rank = client_to_rank(client);
+
+
+                    // Ask the same client for other candidates of the same block of
+                    // MAX_REQUEST_BATCH segments that it has, up to config.request_batch in total.
+                    int word = segment_index / BITS_PER_WORD;
+                    bitset_word_t batch = (bitset_word_t) 1 << (segment_index % BITS_PER_WORD);
+                    bitset_word_t extra = candidates[i][word] & client_segments(swarm_views[i], rank_to_client(client_rank))[word];
+
+                    for (int b = 1; b < config.request_batch && extra != 0; b++) {
+                        batch |= extra & -extra;
+                        extra &= extra - 1;
+                    }
+
+                    candidates[i][word] &= ~batch;
+
+                    if (config.endgame > 0) {
+                        for (bitset_word_t segments = batch; segments != 0; segments &= segments - 1) {
+                            requested_from[i][word * BITS_PER_WORD + __builtin_ctzll(segments)] = rank_to_client(client_rank);
+                        }
+                    }
+
+
+                    // Let a worker request the hashes from the selected client.
+                    download_task_t task;
+                    task.client_rank = client_rank;
+                    task.file_index = i;
+                    task.segment_index = word * BITS_PER_WORD;
+                    task.segments = batch;
+
+                    push_task(queue, i % num_workers, task);
+                    start_peer_request(scores, rank_to_client(client_rank));
+
+                    in_flight[i][word] |= batch;
+                    num_in_flight++;
+                }
             }
 
+            // Endgame: ask the segments in flight of the almost complete files from a
+            // second peer, the best one other than the one already asked, in batches
+            // like above. The first hash that arrives is kept.
+            for (int i = 0; i < num_files && endgame && num_in_flight < 2 * window_size; i++) {
 
-            // Select a client that has this segment, but find a different one than the
-            // client used for the previous download (if it exists).
-            int client_rank = previous_peer;
+                if (requested_files[i] == 0 || missing[i] > config.endgame) {
+                    continue;
+                }
 
-            for (int j = 0; j < num_clients; j++) {
-                if (peers[j][segment_index] != 0 && j+1 != client_rank) {
+                for (int word = 0; word < (int) in_flight[i].size() && num_in_flight < 2 * window_size; word++) {
+                    bitset_word_t outstanding = in_flight[i][word] & ~have[i][word] & ~duplicated[i][word];
 
-                    client_rank = j + 1;
-                    previous_peer = client_rank;
-                    break;
+                    while (outstanding != 0 && num_in_flight < 2 * window_size) {
+                        int segment_index = word * BITS_PER_WORD + __builtin_ctzll(outstanding);
+                        int client = select_peer(scores, swarm_views[i], segment_index, self, requested_from[i][segment_index],
+                                                 config.two_choices, &seed);
+
+                        // No other peer has it.
+                        if (client == -1) {
+                            outstanding &= outstanding - 1;
+                            continue;
+                        }
+
+                        bitset_word_t batch = 0;
+                        int batch_size = 0;
+
+                        for (bitset_word_t rest = outstanding; rest != 0 && batch_size < config.request_batch; rest &= rest - 1) {
+                            int k = word * BITS_PER_WORD + __builtin_ctzll(rest);
+
+                            if (has_segment(swarm_views[i], client, k) && requested_from[i][k] != client) {
+                                batch |= rest & -rest;
+                                requested_from[i][k] = client;
+                                batch_size++;
+                            }
+                        }
+
+                        outstanding &= ~batch;
+
+                        download_task_t task;
+                        task.client_rank = client_to_rank(client);
+                        task.file_index = i;
+                        task.segment_index = word * BITS_PER_WORD;
+                        task.segments = batch;
+
+                        push_task(queue, i % num_workers, task);
+                        start_peer_request(scores, client);
+
+                        duplicated[i][word] |= batch;
+                        num_in_flight++;
+                    }
                 }
             }
+        }
 
-            // No client was found for this segment, skip.
-            if (client_rank == -1) {
-                continue;
+        // Nothing to request yet. Announce the segments downloaded so far, others may
+        // wait for them, then wait until a view changes or is due to be asked again.
+        if (num_in_flight == 0 && config.gossip > 0) {
+            uint64_t start = stats_start(stats);
+
+            do {
+                send_gossip(gossip, swarm_views);
+            } while (!wait_gossip(gossip, swarm_views, download_arg->timer));
+
+            record_wait(stats, start);
+
+            continue;
+        }
+
+        if (num_in_flight == 0) {
+            if (!download_history.empty()) {
+                send_have_update(download_history);
             }
 
+            double refresh_deadline = -1;
 
-            // Request the hash from the selected client.
-            peer_message_t peer_message;
-            peer_message.file_index = i;
-            peer_message.segment_index = segment_index;
+            for (int i = 0; i < num_files; i++) {
+                if (requested_files[i] != 0 && (refresh_deadline < 0 || refresh_times[i] + refresh_interval < refresh_deadline)) {
+                    refresh_deadline = refresh_times[i] + refresh_interval;
+                }
+            }
 
-            MPI_Ssend(&peer_message, 1, create_peer_message_datatype(), client_rank, 4, MPI_COMM_WORLD);
+            uint64_t start = stats_start(stats);
 
-            char hash[HASH_SIZE+1] = {0};
-            MPI_Recv(hash, HASH_SIZE, MPI_CHAR, client_rank, 5, MPI_COMM_WORLD, &s);
+            if (MPI_Wtime() < refresh_deadline) {
+                wait_for_invalidations(stale, refresh_deadline, download_arg->timer, stats);
+            }
 
-            // Save the received hash.
-            files[i][segment_index] = hash;
-            
-            // Add it to the download history.
-            download_history.push_back(make_pair(i, segment_index));
+            record_wait(stats, start);
 
-            // If the client has downloaded 10 files, update the tracker.
-            if (download_history.size() == MAX_FILES_BEFORE_UPDATING_TRACKER) {
-                for (int j = 0; j < download_history.size(); j++) {
+            continue;
+        }
 
-                    // Tell the tracker that this client now has this hash.
-                    tracker_message.code = 7;
-                    tracker_message.file_index = download_history[j].first;
-                    tracker_message.segment_index = download_history[j].second;
 
-                    MPI_Ssend(&tracker_message, 1, create_tracker_message_datatype(), TRACKER_RANK, 7, MPI_COMM_WORLD);
-                }
+        // Wait for the workers to return at least one result. While an update waits
+        // to be sent, wait only until its time comes, then send it.
+        double timeout = -1;
+
+        if (!download_history.empty() && config.have_interval > 0) {
+            timeout = max(0.0, history_deadline - MPI_Wtime());
+        }
+
+        if (config.gossip > 0 && gossip_deadline(gossip) >= 0) {
+            timeout = max(0.0, gossip_deadline(gossip) - MPI_Wtime());
+        }
+
+        uint64_t start = stats_start(stats);
+
+        take_results(queue, results, timeout);
+
+        record_wait(stats, start);
+
+        // The update is due even if results keep arriving before its time.
+        if (config.gossip > 0) {
+            send_gossip(gossip, swarm_views);
+        } else if (!download_history.empty() && config.have_interval > 0 && MPI_Wtime() >= history_deadline) {
+            send_have_update(download_history);
+        }
+
+        if (results.empty()) {
+            continue;
+        }
+
+        for (auto& reply : results) {
+            num_in_flight--;
+
+            finish_peer_request(scores, reply.client, reply.rtt);
 
-                // Reset the history.
-                download_history.clear();
+            // The hashes are already stored and queued for writing by the worker.
+            int i = reply.file_index;
+            int word = reply.segment_index / BITS_PER_WORD;
+
+            // A segment asked twice stays in flight until both requests are back. Only
+            // the segments whose hash came first with this request are new.
+            bitset_word_t twice = config.endgame > 0 ? reply.requested & duplicated[i][word] : 0;
+
+            if (twice != 0) {
+                duplicated[i][word] &= ~twice;
             }
 
-            
-            // Check if this file is complete.
-            bool complete = true;
+            in_flight[i][word] &= ~(reply.requested & ~twice);
+            have[i][word] |= reply.segments;
+            missing[i] -= __builtin_popcountll(reply.segments);
 
-            for (int j = 0; j < file_sizes[i]; j++) {
-                if (files[i][j].size() != HASH_SIZE) {
-                    complete = false;
-                    break;
+            // In gossip mode the neighbours are told instead of the tracker.
+            if (config.gossip > 0) {
+                gossip_word(gossip, swarm_views, i, self, word, reply.segments);
+            } else {
+                for (bitset_word_t segments = reply.segments; segments != 0; segments &= segments - 1) {
+
+                    // Add it to the download history.
+                    if (download_history.empty()) {
+                        history_deadline = MPI_Wtime() + config.have_interval / 1000.0;
+                    }
+
+                    download_history.push_back(make_pair(i, reply.segment_index + __builtin_ctzll(segments)));
+
+                    // If the batch is full, update the tracker.
+                    if ((int) download_history.size() == config.have_batch_size) {
+                        send_have_update(download_history);
+                    }
                 }
             }
 
+            
+            // Check if this file is complete, the other requests asked twice come later.
+            bool complete = requested_files[i] != 0 && missing[i] == 0;
+
             if (complete) {
                 
                 // Signal the tracker that the client has finished downloading this file.
-                tracker_message_t tracker_message;
-                tracker_message.code = 6;
-                tracker_message.file_index = i;
-                
-                MPI_Ssend(&tracker_message, 1, create_tracker_message_datatype(), TRACKER_RANK, 6, MPI_COMM_WORLD);
+                if (config.gossip == 0) {
+                    tracker_message_t tracker_message;
+                    tracker_message.kind = TRACKER_FILE_COMPLETE;
+                    tracker_message.file_index = i;
+
+                    send_tracker_message(tracker_message, file_tracker(i));
+                }
 
                 // This file is no longer required to download.
                 requested_files[i] = 0;
 
-                // Write the output.
-                write_output_file(rank, i, file_sizes[i], files[i]);
+                // All its segments were queued for writing, the writer can close the output.
+                complete_output_file(writer, i);
 
                 // Check if all the requested files have completed.
                 bool all_complete = true;
 
-                for (int j = 0; j < MAX_FILES; j++) {
+                for (int j = 0; j < num_files; j++) {
                     if (requested_files[j] != 0) {
                         all_complete = false;
                         break;
@@ -293,12 +965,26 @@ void *download_thread_func(void *arg)
 
                 // Exit the download thread if all files have finished downloading.
                 if (all_complete) {
-                    
-                    tracker_message_t tracker_message;
-                    tracker_message.code = 8;
 
-                    // Signal the tracker that this client has finished all downloads.
-                    MPI_Ssend(&tracker_message, 1, create_tracker_message_datatype(), TRACKER_RANK, 8, MPI_COMM_WORLD);
+                    // Wait for the requests asked twice, whose hashes the workers drop,
+                    // the ones after this reply are already here. Then the workers can stop.
+                    int pending = num_in_flight - (&results.back() - &reply);
+                    vector<download_result_t> late_results;
+
+                    while (pending > 0) {
+                        take_results(queue, late_results, -1);
+                        pending -= late_results.size();
+                    }
+
+                    stop_download_workers(queue, workers);
+
+                    // Signal the trackers that this client has finished all downloads.
+                    send_done_messages();
+
+                    if (config.gossip > 0) {
+                        relay_gossip(gossip, swarm_views, download_arg->timer, download_arg->shutdown);
+                    }
+
                     return NULL;
                 }
             }
@@ -309,228 +995,615 @@ void *download_thread_func(void *arg)
 }
 
 
+/**
+ * Thread function that sends the requested hashes. Several senders drain the
+ * same request queue; each keeps up to MAX_PENDING_SENDS non-blocking sends in
+ * flight, so a slow downloader doesn't stall the replies to the others.
+*/
+void *upload_sender_func(void *arg)
+{
+    // Unpack the arguments.
+    upload_sender_arg_t* sender_arg = (upload_sender_arg_t*) arg;
+    request_queue_t *queue = sender_arg->queue;
+    hash_store_t& files = *sender_arg->files;
+    pthread_mutex_t *files_mutex = sender_arg->files_mutex;
+
+    thread_stats_t *stats = register_thread_stats(("upload sender " + to_string(sender_arg->sender)).c_str());
+
+    vector<hash_reply_t> replies(MAX_PENDING_SENDS);
+    vector<MPI_Request> send_requests(MAX_PENDING_SENDS, MPI_REQUEST_NULL);
+
+    while (true) {
+
+        uint64_t wait_start = stats_start(stats);
+
+        upload_request_t request = pop_request(queue);
+
+        record_wait(stats, wait_start);
+
+        if (request.file_index == -1) {
+            // Shutdown, after the pending replies are delivered.
+            MPI_Waitall(MAX_PENDING_SENDS, &send_requests[0], MPI_STATUSES_IGNORE);
+            return NULL;
+        }
+
+        uint64_t start = stats_start(stats);
+
+        // Find a free reply buffer, waiting for a send to finish if all are in use.
+        int slot = 0;
+        while (slot < MAX_PENDING_SENDS && send_requests[slot] != MPI_REQUEST_NULL) {
+            int done;
+            MPI_Test(&send_requests[slot], &done, MPI_STATUS_IGNORE);
+
+            if (!done) {
+                slot++;
+            }
+        }
+
+        if (slot == MAX_PENDING_SENDS) {
+            MPI_Waitany(MAX_PENDING_SENDS, &send_requests[0], &slot, MPI_STATUS_IGNORE);
+        }
+
+        // Get the requested hashes, in the order of the segments.
+        hash_reply_t& reply = replies[slot];
+        reply.file_index = request.file_index;
+        reply.segment_index = request.segment_index;
+        reply.segments = request.segments;
+
+        int num_hashes = 0;
+
+        pthread_mutex_lock(files_mutex);
+        for (uint64_t segments = request.segments; segments != 0; segments &= segments - 1) {
+            reply.hashes[num_hashes++] = segment_hash(files, request.file_index, request.segment_index + __builtin_ctzll(segments));
+        }
+        pthread_mutex_unlock(files_mutex);
+
+        // Send them to the requesting client, only as many hashes as were requested.
+        MPI_Isend(&reply, hash_reply_size(num_hashes), MPI_BYTE, request.client_rank, 5, MPI_COMM_WORLD, &send_requests[slot]);
+
+        record_message(stats, 5, start);
+    }
+
+    return NULL;
+}
+
+
 /**
  * Thread function that handles uploading segments to other peers.
+ * Receives the requests and passes them to a pool of config.upload_threads
+ * senders through a bounded queue. Requests that don't fit are kept in a
+ * backlog per requesting client and admitted round-robin, one request per
+ * client at a time, so one client asking for many segments can't fill the
+ * queue ahead of the others.
 */
 void *upload_thread_func(void *arg)
 {
     // Unpack the arguments.
     upload_thread_arg_t* upload_arg = (upload_thread_arg_t*) arg;
-    int rank = upload_arg->rank;
     int num_clients = upload_arg->num_clients;
-    vector<vector<string>> files = upload_arg->files;
-    vector<int> file_sizes = upload_arg->file_sizes;
+    int num_senders = config.upload_threads;
+
+    request_queue_t *queue = create_request_queue(config.upload_queue_size);
+
+    thread_stats_t *stats = register_thread_stats("upload");
+
+    // Start the senders.
+    vector<upload_sender_arg_t> sender_args(num_senders);
+    vector<pthread_t> senders(num_senders);
+
+    for (int i = 0; i < num_senders; i++) {
+        sender_args[i].sender = i;
+        sender_args[i].queue = queue;
+        sender_args[i].files = upload_arg->files;
+        sender_args[i].files_mutex = upload_arg->files_mutex;
+
+        int r = pthread_create(&senders[i], NULL, upload_sender_func, (void *) &sender_args[i]);
+        if (r) {
+            printf("Eroare la crearea thread-ului de upload\n");
+            exit(-1);
+        }
+    }
+
+    // Requests that didn't fit in the queue, backlogs[j] holds the ones from the client with index j.
+    vector<deque<upload_request_t>> backlogs(num_clients);
+    int num_backlogged = 0;
+    int next_client = 0;
+
+    peer_message_t peer_message;
+    MPI_Request recv_request;
+    MPI_Status s;
+
+    MPI_Irecv(&peer_message, 1, datatypes.peer_message, MPI_ANY_SOURCE, 4, MPI_COMM_WORLD, &recv_request);
 
     while (true) {
 
-        MPI_Status s;
-        peer_message_t peer_message;
-        
-        // Receive a message.
-        MPI_Recv(&peer_message, 1, create_peer_message_datatype(), MPI_ANY_SOURCE, 4, MPI_COMM_WORLD, &s);
+        // Only block on the next request when nothing waits to be queued.
+        int received = 1;
 
-        int file_index = peer_message.file_index;
-        int segment_index = peer_message.segment_index;
-        int client_rank = s.MPI_SOURCE;
+        if (num_backlogged == 0) {
+            uint64_t start = stats_start(stats);
 
-        if (file_index == -1 && segment_index == -1) {
-            // Shutdown.
-            return NULL;
+            MPI_Wait(&recv_request, &s);
+
+            record_wait(stats, start);
+        } else {
+            MPI_Test(&recv_request, &received, &s);
+        }
+
+        if (received) {
+            uint64_t start = stats_start(stats);
+            int file_index = peer_message.file_index;
+            int segment_index = peer_message.segment_index;
+            int client_rank = s.MPI_SOURCE;
+
+            if (file_index == -1 && segment_index == -1) {
+                upload_arg->shutdown->store(true);
+                wake_timer(upload_arg->timer);
+                break;
+            }
+
+            upload_request_t request;
+            request.client_rank = client_rank;
+            request.file_index = file_index;
+            request.segment_index = segment_index;
+            request.segments = peer_message.segments;
+
+            backlogs[rank_to_client(client_rank)].push_back(request);
+            num_backlogged++;
+
+            MPI_Irecv(&peer_message, 1, datatypes.peer_message, MPI_ANY_SOURCE, 4, MPI_COMM_WORLD, &recv_request);
+
+            record_message(stats, 4, start);
+        }
+
+        // Move requests to the queue, taking one from each client in turn. When the
+        // queue is full and no new request came, sleep until a sender frees a cell.
+        int skipped = 0;
+        bool wait_for_room = !received;
+
+        while (num_backlogged > 0 && skipped <= num_clients) {
+            deque<upload_request_t>& backlog = backlogs[next_client];
+            next_client = (next_client + 1) % num_clients;
+
+            if (backlog.empty()) {
+                skipped++;
+                continue;
+            }
+
+            if (!try_push_request(queue, backlog.front())) {
+                if (!wait_for_room) {
+                    break;
+                }
+
+                uint64_t start = stats_start(stats);
+
+                push_request(queue, backlog.front());
+
+                record_wait(stats, start);
+
+                wait_for_room = false;
+            }
+
+            backlog.pop_front();
+            num_backlogged--;
+            skipped = 0;
         }
+    }
+
+    // Shutdown: queue what's left, then one stop request for each sender.
+    for (int j = 0; j < num_clients; j++) {
+        for (auto& request : backlogs[j]) {
+            push_request(queue, request);
+        }
+    }
 
-        // Get the requested hash.
-        auto hash = files[file_index][segment_index].c_str();
+    for (int i = 0; i < num_senders; i++) {
+        upload_request_t stop_request;
+        stop_request.client_rank = -1;
+        stop_request.file_index = -1;
+        stop_request.segment_index = -1;
+        stop_request.segments = 0;
 
-        // Send it to the requesting client.
-        MPI_Ssend(hash, HASH_SIZE, MPI_CHAR, client_rank, 5, MPI_COMM_WORLD);
+        push_request(queue, stop_request);
     }
 
+    for (int i = 0; i < num_senders; i++) {
+        pthread_join(senders[i], NULL);
+    }
+
+    destroy_request_queue(queue);
+
     return NULL;
 }
 
 
+/**
+ * Returns a free reply slot of the tracker, waiting for a reply to finish if there
+ * is none. requests[TRACKER_RECEIVES + r] is the request of slot r.
+*/
+int find_reply_slot(vector<MPI_Request>& requests) {
+    int r = 0;
+    while (r < TRACKER_REPLIES && requests[TRACKER_RECEIVES + r] != MPI_REQUEST_NULL) {
+        r++;
+    }
+
+    if (r == TRACKER_REPLIES) {
+        MPI_Waitany(TRACKER_REPLIES, &requests[TRACKER_RECEIVES], &r, MPI_STATUS_IGNORE);
+    }
+
+    return r;
+}
+
+
+/**
+ * Returns true if the files of a decoded message are kept by this tracker, and its
+ * segments are in those files, so that it can be applied to the swarms.
+*/
+bool check_tracker_message(const tracker_message_t& message, const vector<swarm_t>& swarm, int rank) {
+    switch (message.kind) {
+    case TRACKER_PEERS_REQUEST:
+    case TRACKER_FILE_COMPLETE:
+        return message.file_index >= 0 && message.file_index < (int) swarm.size() && file_tracker(message.file_index) == rank;
+    case TRACKER_HAVE:
+        for (auto& segment : message.segments) {
+            if (segment.first < 0 || segment.first >= (int) swarm.size() || file_tracker(segment.first) != rank ||
+                segment.second < 0 || segment.second >= swarm[segment.first].num_segments) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    return true;
+}
+
+
+/**
+ * Tells the clients watching the swarm of a file that it changed, except the
+ * client that changed it. A client is told once, it watches again from its next
+ * tag 3 request, so at most one of these waits for each client and file.
+*/
+void invalidate_swarm(int file_index, int changed_by, vector<char>& watchers,
+                      vector<vector<bitset_word_t>>& reply_buffers, vector<MPI_Request>& requests) {
+    for (int j = 0; j < (int) watchers.size(); j++) {
+        if (!watchers[j] || j == changed_by) {
+            continue;
+        }
+
+        watchers[j] = 0;
+
+        int r = find_reply_slot(requests);
+        reply_buffers[r].assign(1, file_index);
+
+        MPI_Isend(&reply_buffers[r][0], 1, MPI_UINT64_T, client_to_rank(j), TRACKER_INVALIDATE,
+                  MPI_COMM_WORLD, &requests[TRACKER_RECEIVES + r]);
+    }
+}
+
+
 /**
  * Function that handles requests sent to the tracker.
 */
 void tracker(int numtasks, int rank) {
 
-    int num_clients = numtasks - 1;
+    int num_clients = numtasks - config.num_trackers;
 
-    // Swarm structure, swarm[i][j][k] : i = file index, j = client index, k = segment. 
-    vector<vector<vector<int>>> swarm(MAX_FILES, vector<vector<int>>(num_clients, vector<int>(MAX_CHUNKS, 0)));
+    // File sizes and fingerprints. swarm_file_sizes[i] : i = file index. The number
+    // of files is the highest file index any client has, plus one.
+    vector<int> swarm_file_sizes;
+    vector<uint64_t> swarm_fingerprints;
 
-    // File sizes. swarm_file_sizes[i] : i = file index.
-    vector<int> swarm_file_sizes(MAX_FILES, 0);
+    // client_inventories[j] : the files the client with index j has, and the checkpoints it resumes.
+    vector<inventory_t> client_inventories(num_clients);
 
-    MPI_Barrier(MPI_COMM_WORLD);
+    // Gather which files each client has, and the partial downloads it resumes. Every
+    // tracker is the root of one gather, the trackers have nothing to contribute.
+    // The list of sizes ends at the client's last file.
+    vector<vector<int>> inventories;
+
+    for (int t = 0; t < config.num_trackers; t++) {
+        vector<vector<int>> gathered;
+        gather_inventories(vector<int>(), t, gathered);
+
+        if (t == rank) {
+            inventories = gathered;
+        }
+    }
 
-    // Receive which files each client has.
     for (int i = 0; i < num_clients; i++) {
 
-        int client_file_sizes[MAX_FILES];
-        memset(client_file_sizes, 0, sizeof(client_file_sizes));
+        int client_rank = client_to_rank(i);
+        int client = i;
+        inventory_t& client_inventory = client_inventories[client];
+
+        vector<int>& inventory = inventories[client_rank];
+        int size = inventory.size();
 
-        MPI_Status s;
+        if (!decode_inventory(inventory.data(), size, client_inventory)) {
+            fprintf(stderr, "Inventar invalid de la clientul %d\n", client_rank);
+            client_inventory = inventory_t();
+        }
+
+        vector<int>& sizes = client_inventory.file_sizes;
+        int num_sizes = sizes.size();
 
-        MPI_Recv(client_file_sizes, MAX_FILES, MPI_INT, MPI_ANY_SOURCE, 1, MPI_COMM_WORLD, &s);
+        if (num_sizes > (int) swarm_file_sizes.size()) {
+            swarm_file_sizes.resize(num_sizes, 0);
+            swarm_fingerprints.resize(num_sizes, 0);
+        }
 
-        int client_rank = s.MPI_SOURCE;
+        for (int j = 0; j < num_sizes; j++) {
+            if (sizes[j] != 0) {
+                swarm_file_sizes[j] = sizes[j];
+                swarm_fingerprints[j] = client_inventory.fingerprints[j];
+            }
+        }
+    }
 
-        // In the swarm, for each file, mark all its chunks as being at client who sent the message.
+    // Send the file sizes and fingerprints to all the clients (instead of an OK signal).
+    // All the trackers merged the same table, the coordinator's is broadcast.
+    broadcast_file_sizes(swarm_file_sizes, swarm_fingerprints, TRACKER_RANK);
 
-        for (int j = 0; j < MAX_FILES; j++) {
-            if (client_file_sizes[j] != 0) {
-                
-                swarm_file_sizes[j] = client_file_sizes[j];
+    // The trackers take part in creating the window of the clients' hashes, with nothing in it.
+    hash_window_t *window = config.rma ? create_hash_window(NULL, swarm_file_sizes.size()) : NULL;
 
-                for (int k = 0; k < client_file_sizes[j]; k++) {
-                    swarm[j][client_rank-1][k] = k+1;
-                }
+    // Swarm structure, swarm[i].segments[j][k] : i = file index, j = client index, k = segment.
+    // Only the files of this tracker have clients in their swarm.
+    vector<swarm_t> swarm;
+
+    for (int i = 0; i < (int) swarm_file_sizes.size(); i++) {
+        swarm.push_back(create_swarm(file_tracker(i) == rank ? num_clients : 0, swarm_file_sizes[i], 0));
+    }
+
+    // In the swarm, for each file, mark all its chunks as being at the clients that have it.
+    for (int j = 0; j < num_clients; j++) {
+        inventory_t& client_inventory = client_inventories[j];
+
+        for (int i = 0; i < (int) client_inventory.file_sizes.size(); i++) {
+            if (client_inventory.file_sizes[i] != 0 && file_tracker(i) == rank) {
+                seed_swarm(swarm[i], j, client_inventory.file_sizes[i]);
             }
         }
-    }    
 
-    // Send file sizes to all clients (instead of OK signal).
-    for (int i = 0; i < num_clients; i++) {
-        MPI_Ssend(&swarm_file_sizes[0], MAX_FILES, MPI_INT, i+1, 2, MPI_COMM_WORLD);
+        // And the segments of the checkpoints made for the same file, the client keeps only those.
+        for (int i = 0; i < (int) client_inventory.partial_files.size() && i < (int) swarm.size(); i++) {
+            vector<bitset_word_t>& segments = client_inventory.partial_files[i];
+
+            if (!segments.empty() && file_tracker(i) == rank && client_inventory.partial_sizes[i] == swarm_file_sizes[i] &&
+                client_inventory.partial_fingerprints[i] == swarm_fingerprints[i]) {
+                seed_swarm_segments(swarm[i], j, &segments[0]);
+            }
+        }
     }
 
-    MPI_Barrier(MPI_COMM_WORLD);
+    // Termination: messages_received[j] counts the messages from the client with index j,
+    // messages_announced[j] is the count in its done message, -1 until it arrives. The
+    // client has finished once the two are equal, even if the done message overtook others.
+    vector<int> messages_received(num_clients, 0);
+    vector<int> messages_announced(num_clients, -1);
+    vector<char> finished(num_clients, 0);
+    int num_finished_clients = 0;
+
+    // The tracker keeps TRACKER_RECEIVES persistent receives posted and up to TRACKER_REPLIES
+    // replies in flight, and handles whatever completes. requests[k] with k < TRACKER_RECEIVES
+    // are the receives, the others are the replies, MPI_REQUEST_NULL when the slot is free.
+    int max_message_size = max_tracker_message_size(config.have_batch_size);
+    vector<vector<int>> receive_buffers(TRACKER_RECEIVES, vector<int>(max_message_size));
+    vector<vector<bitset_word_t>> reply_buffers(TRACKER_REPLIES);
+    vector<MPI_Request> requests(TRACKER_RECEIVES + TRACKER_REPLIES, MPI_REQUEST_NULL);
+
+    // Messages from the same client match the receives in the order they were
+    // started, so handling them in that order keeps them in the order they were sent.
+    vector<long> start_order(TRACKER_RECEIVES);
+    long num_started = 0;
+
+    for (int k = 0; k < TRACKER_RECEIVES; k++) {
+        MPI_Recv_init(&receive_buffers[k][0], max_message_size, MPI_INT, MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &requests[k]);
+        MPI_Start(&requests[k]);
+        start_order[k] = num_started++;
+    }
 
-    // Stores how many clients are currently downloading files.
-    int num_downloading_clients = num_clients;
+    // watchers[i][j] is set while the client with index j keeps a view of the swarm of
+    // file i that the tracker hasn't invalidated yet, only for the files of this tracker.
+    vector<vector<char>> watchers(swarm.size());
 
-    while (true) {
+    for (int i = 0; i < (int) swarm.size(); i++) {
+        if (file_tracker(i) == rank && config.invalidations) {
+            watchers[i].assign(num_clients, 0);
+        }
+    }
 
-        tracker_message_t tracker_message;
-        MPI_Status s;
-        
-        // Receive a message.
-        MPI_Recv(&tracker_message, 1, create_tracker_message_datatype(), MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &s);
-        
-        int tag = s.MPI_TAG;
-        int client_rank = s.MPI_SOURCE;
+    vector<int> completed(requests.size());
+    vector<MPI_Status> statuses(requests.size());
+    bool running = true;
 
+    thread_stats_t *stats = register_thread_stats("tracker");
 
+    while (running) {
 
-        if (tag == 3) {
-            
-            // Tag 3: the client wants a list of all peers and their chunks for file at file_index.
+        uint64_t wait_start = stats_start(stats);
 
-            int file_index = tracker_message.file_index;
+        int num_completed;
+        MPI_Waitsome(requests.size(), &requests[0], &num_completed, &completed[0], &statuses[0]);
 
-            // Build the reply.
-            int peers[num_clients][MAX_CHUNKS];
-            for (int i = 0; i < num_clients; i++) {
-                for (int j = 0; j < MAX_CHUNKS; j++) {
-                    peers[i][j] = swarm[file_index][i][j];
-                }
-            }
+        record_wait(stats, wait_start);
+
+        // Finished replies only free their slot. Sort the received messages by receive order.
+        vector<pair<long, int>> received;
 
-            MPI_Ssend(peers, num_clients * MAX_CHUNKS, MPI_INT, client_rank, 3, MPI_COMM_WORLD);
+        for (int c = 0; c < num_completed; c++) {
+            if (completed[c] < TRACKER_RECEIVES) {
+                received.push_back(make_pair(start_order[completed[c]], c));
+            }
         }
-        else if (tag == 6) {
 
-            // Tag 6: Client has finished downloading file at file_index.
+        sort(received.begin(), received.end());
 
-            int file_index = tracker_message.file_index;
-            
-            // Update the swarm to show that all chunks of file at file_index are available on this client.
-            for (int i = 0; i < swarm_file_sizes[i]; i++) {
-                swarm[file_index][client_rank-1][i] = i+1;
+        for (auto& message : received) {
+            uint64_t start = stats_start(stats);
+            int k = completed[message.second];
+            MPI_Status& s = statuses[message.second];
+
+            tracker_message_t tracker_message;
+            int size;
+            MPI_Get_count(&s, MPI_INT, &size);
+
+            // A message with files or segments out of range is rejected like a malformed one.
+            bool valid = decode_tracker_message(&receive_buffers[k][0], size, tracker_message) &&
+                         check_tracker_message(tracker_message, swarm, rank);
+
+            // The buffer was decoded, it can receive the next message.
+            MPI_Start(&requests[k]);
+            start_order[k] = num_started++;
+
+            int kind = valid ? tracker_message.kind : -1;
+            int client_rank = s.MPI_SOURCE;
+            int sender = rank_to_client(client_rank);
+
+            // Tag 8: the client has finished downloading all files, and says how many
+            // messages to expect from it. Every other message is counted.
+            if (kind == TRACKER_DONE) {
+                messages_announced[sender] = tracker_message.count;
+            } else {
+                messages_received[sender]++;
+            }
+
+            if (!valid) {
+                fprintf(stderr, "Mesaj invalid de la clientul %d (tag %d)\n", s.MPI_SOURCE, s.MPI_TAG);
             }
-        }
-        else if (tag == 7) {
-            
-            // Tag 7: Client wants to update its swarm file list.
 
-            int file_index = tracker_message.file_index;
-            int segment_index = tracker_message.segment_index;
 
-            swarm[file_index][client_rank-1][segment_index] = segment_index + 1;
-        }
-        else if (tag == 8) {
 
-            // Tag 8: Client has finished downloading all files.
+            if (kind == TRACKER_PEERS_REQUEST) {
+                
+                // Tag 3: the client wants a list of all peers and their chunks for file at file_index.
+                // It sends the version of the swarm it already knows, so only the changes since then are sent.
 
-            // Decrement number of clients downloading files.
-            num_downloading_clients--;
+                int file_index = tracker_message.file_index;
 
-            if (num_downloading_clients == 0) {
+                int r = find_reply_slot(requests);
 
-                // All clients have finished downloading, signal all clients to close the upload thread.
+                // Build the reply, it is kept until the send finishes.
+                reply_buffers[r] = encode_swarm_reply(swarm[file_index], tracker_message.version);
 
-                for (int i = 0; i < num_clients; i++) {
-                    peer_message_t peer_message;
-                    peer_message.file_index = -1;
-                    peer_message.segment_index = -1;
+                MPI_Isend(&reply_buffers[r][0], reply_buffers[r].size(), MPI_UINT64_T, client_rank,
+                          TRACKER_PEERS_REQUEST, MPI_COMM_WORLD, &requests[TRACKER_RECEIVES + r]);
 
-                    MPI_Ssend(&peer_message, 1, create_peer_message_datatype(), i+1, 4, MPI_COMM_WORLD);
+                // The client is told when this view gets out of date.
+                if (!watchers[file_index].empty()) {
+                    watchers[file_index][rank_to_client(client_rank)] = 1;
                 }
-
-                // Finally, exit the tracker.
-                return;
             }
-        }
-    }
-}
+            else if (kind == TRACKER_FILE_COMPLETE) {
 
+                // Tag 6: Client has finished downloading file at file_index.
 
-/**
- * Reads a peer's input file.
-*/
-auto read_input_file(int rank) {
+                int file_index = tracker_message.file_index;
+                int client = rank_to_client(client_rank);
+                bool changed = false;
+                
+                // Update the swarm to show that all chunks of file at file_index are available on this client.
+                for (int i = 0; i < swarm_file_sizes[file_index]; i++) {
+                    changed |= add_to_swarm(swarm[file_index], client, i);
+                }
 
-    // Create the file name.
-    string input_file = "./in" + to_string(rank) + ".txt";
+                // The client no longer needs a view of this swarm.
+                if (!watchers[file_index].empty()) {
+                    watchers[file_index][client] = 0;
+                }
 
-    // Open the file.
-    ifstream file(input_file);
+                if (changed) {
+                    invalidate_swarm(file_index, client, watchers[file_index], reply_buffers, requests);
+                }
+            }
+            else if (kind == TRACKER_HAVE) {
+                
+                // Tag 7: Client wants to update its swarm file list, with all the
+                // segments it downloaded since the last update, applied at once.
+
+                int client = rank_to_client(client_rank);
+                vector<int> changed_files;
 
-    int num_files;
-    int num_requested_files;
-    vector<int> file_sizes(MAX_FILES, 0);
-    vector<vector<string>> files(MAX_FILES, vector<string>(MAX_CHUNKS));
-    vector<int> requested_files(MAX_FILES, 0);
+                for (auto& segment : tracker_message.segments) {
+                    if (add_to_swarm(swarm[segment.first], client, segment.second) &&
+                        find(changed_files.begin(), changed_files.end(), segment.first) == changed_files.end()) {
+                        changed_files.push_back(segment.first);
+                    }
+                }
 
-    // Read the number of files this client has.
-    file >> num_files;
+                for (int file_index : changed_files) {
+                    invalidate_swarm(file_index, client, watchers[file_index], reply_buffers, requests);
+                }
+            }
 
-    // Read segments for each file.
-    for (int i = 0; i < num_files; i++) {
-        string file_name;
-        int num_segments;
+            // This client sends nothing more once all the messages it announced arrived.
+            if (!finished[sender] && messages_announced[sender] == messages_received[sender]) {
+                finished[sender] = 1;
+                num_finished_clients++;
+            }
 
-        file >> file_name >> num_segments;
-    
-        vector<string> segments;
+            // All clients have finished downloading and this tracker got all their messages.
+            // The coordinator also signals all clients to close the upload thread, the others
+            // may still serve segments until then.
+            if (running && num_finished_clients == num_clients) {
+                if (rank == TRACKER_RANK) {
+                    for (int i = 0; i < num_clients; i++) {
+                        peer_message_t peer_message;
+                        peer_message.file_index = -1;
+                        peer_message.segment_index = -1;
+                        peer_message.segments = 0;
+
+                        MPI_Ssend(&peer_message, 1, datatypes.peer_message, client_to_rank(i), 4, MPI_COMM_WORLD);
+                    }
+                }
 
-        for (int j = 0; j < num_segments; j++) {
-            string segment;
+                // Finally, exit the tracker.
+                running = false;
+            }
 
-            file >> segment;
-            segments.push_back(segment);
+            if (valid) {
+                record_message(stats, kind, start);
+            }
         }
+    }
 
-        file_sizes[name_to_index(file_name)] = num_segments;
-        files[name_to_index(file_name)] = segments;
+    // Drop the receives that are still posted and let the last replies finish.
+    for (int k = 0; k < TRACKER_RECEIVES; k++) {
+        MPI_Cancel(&requests[k]);
+        MPI_Wait(&requests[k], MPI_STATUS_IGNORE);
+        MPI_Request_free(&requests[k]);
     }
 
+    // Tell every client that no more invalidations follow, so it can receive the last ones.
+    if (config.invalidations) {
+        for (int j = 0; j < num_clients; j++) {
+            int r = find_reply_slot(requests);
 
-    // Read the number of files the client wants to download.
-    file >> num_requested_files;
+            MPI_Isend(NULL, 0, MPI_UINT64_T, client_to_rank(j), TRACKER_INVALIDATE,
+                      MPI_COMM_WORLD, &requests[TRACKER_RECEIVES + r]);
+        }
+    }
 
-    // Read the file names.
-    for (int i = 0; i < num_requested_files; i++) {
-        string requested_file;
-        file >> requested_file;
+    MPI_Waitall(TRACKER_REPLIES, &requests[TRACKER_RECEIVES], MPI_STATUSES_IGNORE);
 
-        requested_files[name_to_index(requested_file)] = 1; 
+    if (window != NULL) {
+        destroy_hash_window(window);
     }
+}
 
-    file.close();
 
-    return make_tuple(num_files, file_sizes, files, num_requested_files, requested_files);
+/**
+ * Reads a peer's input file. The hashes of the files it has stay in the mapping.
+*/
+void read_input_file(int rank, input_t& input, hash_store_t& files) {
+
+    // Create the file name.
+    string input_file = "./in" + to_string(rank) + ".txt";
+
+    if (!load_input(input_file.c_str(), input, files)) {
+        fprintf(stderr, "Nu s-a putut citi fisierul %s\n", input_file.c_str());
+        exit(-1);
+    }
 }
 
 
@@ -540,38 +1613,128 @@ auto read_input_file(int rank) {
 void peer(int numtasks, int rank) {
 
     // Read the input file.
-    auto [num_files, file_sizes, files, num_requested_files, requested_files] = read_input_file(rank);
+    input_t input;
+    hash_store_t files;
+
+    read_input_file(rank, input, files);
+
+    vector<int>& file_sizes = input.file_sizes;
+    vector<int>& requested_files = input.requested_files;
+
+    // Resume the downloads of a previous run from their checkpoints. partial_files[i]
+    // has the segments of file i already downloaded, with their hashes loaded into
+    // the store. Whether a checkpoint is of the swarm's file is only known after the
+    // handshake, so until then even a complete one stays a requested file.
+    inventory_t inventory;
+    inventory.file_sizes = file_sizes;
+    inventory.fingerprints.assign(file_sizes.size(), 0);
+    inventory.partial_files.resize(requested_files.size());
+    inventory.partial_sizes.assign(requested_files.size(), 0);
+    inventory.partial_fingerprints.assign(requested_files.size(), 0);
+
+    vector<vector<bitset_word_t>>& partial_files = inventory.partial_files;
+
+    for (int i = 0; i < (int) file_sizes.size(); i++) {
+        if (file_sizes[i] != 0) {
+            inventory.fingerprints[i] = file_fingerprint(files, i);
+        }
+    }
+
+    for (int i = 0; i < (int) requested_files.size(); i++) {
+        if (requested_files[i] != 0 && !load_checkpoint(rank, i, config.binary_output, files, partial_files[i],
+                                                        &inventory.partial_sizes[i], &inventory.partial_fingerprints[i])) {
+            partial_files[i].clear();
+        }
+    }
 
-    // Get the files sizes from the tracker.
-    int swarm_file_sizes[MAX_FILES];
-    memset(swarm_file_sizes, 0, sizeof(swarm_file_sizes));
+    // Get the files sizes from the trackers. Every tracker gathers the list of files
+    // of every client and the partial downloads, then the coordinator broadcasts
+    // all the sizes and fingerprints, which also gives the number of files.
+    vector<int> swarm_file_sizes;
+    vector<uint64_t> swarm_fingerprints;
 
-    MPI_Status s;
+    vector<int> encoded_inventory = encode_inventory(inventory);
+    vector<vector<int>> inventories;
+
+    for (int t = 0; t < config.num_trackers; t++) {
+        gather_inventories(encoded_inventory, t, inventories);
+    }
+
+    broadcast_file_sizes(swarm_file_sizes, swarm_fingerprints, TRACKER_RANK);
+
+    int num_swarm_files = swarm_file_sizes.size();
+
+    file_sizes.resize(num_swarm_files, 0);
+    requested_files.resize(num_swarm_files, 0);
+    partial_files.resize(num_swarm_files);
+    inventory.partial_sizes.resize(num_swarm_files, 0);
+    inventory.partial_fingerprints.resize(num_swarm_files, 0);
+
+    // Select only the file sizes for the requested files, and make room for their hashes.
+    // The slots are all reserved here, the threads only write into them. Files nobody
+    // has can't be downloaded, so they are dropped from the requests. A checkpoint of
+    // another size or fingerprint is from another file, it is dropped too (the trackers
+    // ignored it as well). A file whose checkpoint is complete is one the client has.
+    for (int i = 0; i < num_swarm_files; i++) {
+        if (requested_files[i] == 1 && swarm_file_sizes[i] == 0) {
+            requested_files[i] = 0;
+        }
 
-    MPI_Ssend(&file_sizes[0], MAX_FILES, MPI_INT, TRACKER_RANK, 1, MPI_COMM_WORLD);
-    MPI_Recv(swarm_file_sizes, MAX_FILES, MPI_INT, TRACKER_RANK, MPI_ANY_TAG, MPI_COMM_WORLD, &s);
-    
-    // Select only the file sizes for the requested files.
-    for (int i = 0; i < MAX_FILES; i++) {
         if (requested_files[i] == 1) {
             file_sizes[i] = swarm_file_sizes[i];
+
+            bool resumed = !partial_files[i].empty() && inventory.partial_sizes[i] == file_sizes[i] &&
+                           inventory.partial_fingerprints[i] == swarm_fingerprints[i];
+
+            if (!resumed) {
+                partial_files[i].assign(BITSET_WORDS(file_sizes[i]), 0);
+                add_file(files, i, file_sizes[i]);
+            } else if (count_bits(&partial_files[i][0], partial_files[i].size()) == file_sizes[i]) {
+                requested_files[i] = 0;
+                partial_files[i].clear();
+            }
         }
     }
 
-    MPI_Barrier(MPI_COMM_WORLD);
+    // With --rma, the other clients read the hashes from a window over the store,
+    // which no longer grows.
+    hash_window_t *window = config.rma ? create_hash_window(&files, num_swarm_files) : NULL;
+
+    // The hashes are shared by the two threads.
+    pthread_mutex_t files_mutex;
+    pthread_mutex_init(&files_mutex, NULL);
+
+    // Set by the upload thread when the coordinator stops the clients.
+    atomic<bool> shutdown(false);
+
+    // Ends the waits of the download thread on time, or when the clients are stopped.
+    wake_timer_t *timer = create_wake_timer();
+
+    // Create the output files and start writing them.
+    output_writer_t *writer = create_output_writer(rank, file_sizes, swarm_fingerprints, requested_files, partial_files,
+                                                   find_fsync_policy(config.fsync), config.binary_output);
 
     // Build thread arguments.
     auto download_thread_arg = new download_thread_arg_t;
     download_thread_arg->rank = rank;
-    download_thread_arg->num_clients = numtasks - 1;
+    download_thread_arg->num_clients = numtasks - config.num_trackers;
     download_thread_arg->requested_files = requested_files;
     download_thread_arg->file_sizes = file_sizes;
+    download_thread_arg->swarm_file_sizes = swarm_file_sizes;
+    download_thread_arg->partial_files = partial_files;
+    download_thread_arg->files = &files;
+    download_thread_arg->files_mutex = &files_mutex;
+    download_thread_arg->writer = writer;
+    download_thread_arg->window = window;
+    download_thread_arg->timer = timer;
+    download_thread_arg->shutdown = &shutdown;
 
     auto upload_thread_arg = new upload_thread_arg_t;
-    upload_thread_arg->rank = rank;
-    upload_thread_arg->num_clients = numtasks - 1;
-    upload_thread_arg->files = files;
-    upload_thread_arg->file_sizes = file_sizes;
+    upload_thread_arg->num_clients = numtasks - config.num_trackers;
+    upload_thread_arg->files = &files;
+    upload_thread_arg->files_mutex = &files_mutex;
+    upload_thread_arg->timer = timer;
+    upload_thread_arg->shutdown = &shutdown;
 
     // Start the threads.
     pthread_t download_thread;
@@ -597,11 +1760,41 @@ void peer(int numtasks, int rank) {
         exit(-1);
     }
 
+    // Let the last writes finish.
+    destroy_output_writer(writer);
+
     r = pthread_join(upload_thread, &status);
     if (r) {
         printf("Eroare la asteptarea thread-ului de upload\n");
         exit(-1);
     }
+
+    destroy_wake_timer(timer);
+
+    // Receive the invalidations sent after the download thread stopped, up to the
+    // empty message of each tracker. They come in order, from the same tracker.
+    if (config.invalidations) {
+        for (int t = 0; t < config.num_trackers; t++) {
+            int count = 1;
+
+            while (count != 0) {
+                uint64_t file_index;
+                MPI_Status s;
+
+                MPI_Recv(&file_index, 1, MPI_UINT64_T, t, TRACKER_INVALIDATE, MPI_COMM_WORLD, &s);
+                MPI_Get_count(&s, MPI_UINT64_T, &count);
+            }
+        }
+    }
+
+    // The others may still read from this client until they all get here.
+    if (window != NULL) {
+        destroy_hash_window(window);
+    }
+
+    pthread_mutex_destroy(&files_mutex);
+
+    unload_input(input);
 }
  
 int main (int argc, char *argv[]) {
@@ -616,12 +1809,30 @@ int main (int argc, char *argv[]) {
     MPI_Comm_size(MPI_COMM_WORLD, &numtasks);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
-    if (rank == TRACKER_RANK) {
+    if (!parse_config(argc, argv) || config.num_trackers >= numtasks) {
+        if (rank == TRACKER_RANK) {
+            print_usage(argv[0]);
+        }
+
+        MPI_Finalize();
+        return -1;
+    }
+
+    if (config.stats != NULL) {
+        start_stats(rank, config.stats);
+    }
+
+    create_datatypes();
+
+    if (rank < config.num_trackers) {
         tracker(numtasks, rank);
     } else {
-        MPI_Barrier(MPI_COMM_WORLD);
         peer(numtasks, rank);
     }
 
+    stop_stats();
+
+    free_datatypes();
+
     MPI_Finalize();
 }
@@ -0,0 +1,178 @@
+#include "wake_timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+/**
+ * Status of a completed wake request, which carries no data.
+*/
+static int wake_query(void *extra_state, MPI_Status *status) {
+    MPI_Status_set_elements(status, MPI_BYTE, 0);
+    MPI_Status_set_cancelled(status, 0);
+    status->MPI_SOURCE = MPI_UNDEFINED;
+    status->MPI_TAG = MPI_UNDEFINED;
+
+    return MPI_SUCCESS;
+}
+
+
+/**
+ * Frees a wake request, it has no state.
+*/
+static int wake_free(void *extra_state) {
+    return MPI_SUCCESS;
+}
+
+
+/**
+ * Cancels a wake request, it is always completed instead.
+*/
+static int wake_cancel(void *extra_state, int complete) {
+    return MPI_SUCCESS;
+}
+
+
+/**
+ * Completes the request being waited on. Called with the mutex held.
+*/
+static void complete_wake_request(wake_timer_t *timer) {
+    MPI_Grequest_complete(timer->request);
+    timer->request = MPI_REQUEST_NULL;
+}
+
+
+/**
+ * Thread function of the timer. Sleeps until the deadline of the request being
+ * waited on, or until there is one, and completes it.
+*/
+static void *wake_timer_func(void *arg) {
+    wake_timer_t *timer = (wake_timer_t *) arg;
+
+    pthread_mutex_lock(&timer->mutex);
+
+    while (!timer->stop) {
+        if (timer->request == MPI_REQUEST_NULL || timer->deadline < 0) {
+            pthread_cond_wait(&timer->changed, &timer->mutex);
+            continue;
+        }
+
+        double remaining = timer->deadline - MPI_Wtime();
+
+        if (remaining <= 0) {
+            complete_wake_request(timer);
+            continue;
+        }
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+
+        long nanoseconds = deadline.tv_nsec + (long) ((remaining - (long) remaining) * 1e9);
+        deadline.tv_sec += (long) remaining + nanoseconds / 1000000000;
+        deadline.tv_nsec = nanoseconds % 1000000000;
+
+        pthread_cond_timedwait(&timer->changed, &timer->mutex, &deadline);
+    }
+
+    pthread_mutex_unlock(&timer->mutex);
+
+    return NULL;
+}
+
+
+/**
+ * Creates a timer and starts its thread.
+*/
+wake_timer_t *create_wake_timer() {
+    wake_timer_t *timer = new wake_timer_t;
+    timer->request = MPI_REQUEST_NULL;
+    timer->deadline = -1;
+    timer->woken = false;
+    timer->stop = false;
+
+    pthread_mutex_init(&timer->mutex, NULL);
+    pthread_cond_init(&timer->changed, NULL);
+
+    int r = pthread_create(&timer->thread, NULL, wake_timer_func, (void *) timer);
+    if (r) {
+        printf("Eroare la crearea thread-ului de timer\n");
+        exit(-1);
+    }
+
+    return timer;
+}
+
+
+/**
+ * Stops the timer's thread and frees the timer. No request may be waited on.
+*/
+void destroy_wake_timer(wake_timer_t *timer) {
+    pthread_mutex_lock(&timer->mutex);
+    timer->stop = true;
+    pthread_cond_signal(&timer->changed);
+    pthread_mutex_unlock(&timer->mutex);
+
+    pthread_join(timer->thread, NULL);
+
+    pthread_cond_destroy(&timer->changed);
+    pthread_mutex_destroy(&timer->mutex);
+    delete timer;
+}
+
+
+/**
+ * Starts the request of a thread about to wait, to wait on with its receives. It
+ * completes at the deadline (never if it is negative), at the next wake_timer(),
+ * or at once if the timer was woken since the last wait.
+*/
+void start_wake_timer(wake_timer_t *timer, double deadline, MPI_Request *request) {
+    MPI_Grequest_start(wake_query, wake_free, wake_cancel, NULL, request);
+
+    pthread_mutex_lock(&timer->mutex);
+
+    timer->request = *request;
+    timer->deadline = deadline;
+
+    if (timer->woken) {
+        timer->woken = false;
+        complete_wake_request(timer);
+    } else {
+        pthread_cond_signal(&timer->changed);
+    }
+
+    pthread_mutex_unlock(&timer->mutex);
+}
+
+
+/**
+ * Ends a wait. The request is completed here if it is still pending, then freed.
+*/
+void finish_wake_timer(wake_timer_t *timer, MPI_Request *request) {
+    pthread_mutex_lock(&timer->mutex);
+
+    if (timer->request != MPI_REQUEST_NULL) {
+        complete_wake_request(timer);
+    }
+
+    pthread_mutex_unlock(&timer->mutex);
+
+    if (*request != MPI_REQUEST_NULL) {
+        MPI_Wait(request, MPI_STATUS_IGNORE);
+    }
+}
+
+
+/**
+ * Ends the current wait on the timer, or the next one if no thread is waiting.
+*/
+void wake_timer(wake_timer_t *timer) {
+    pthread_mutex_lock(&timer->mutex);
+
+    if (timer->request != MPI_REQUEST_NULL) {
+        complete_wake_request(timer);
+    } else {
+        timer->woken = true;
+    }
+
+    pthread_mutex_unlock(&timer->mutex);
+}
@@ -0,0 +1,31 @@
+#ifndef WAKE_TIMER_H
+#define WAKE_TIMER_H
+
+#include <mpi.h>
+#include <pthread.h>
+
+// Lets a thread block in MPI_Waitany (or MPI_Waitsome) on its receives and still
+// wake up in time. The thread waits on a generalized request with them, which the
+// timer's own thread completes at the deadline, or another thread with wake_timer().
+// A wake is kept until the next wait, so one that comes before it isn't lost.
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+
+    // The request being waited on, MPI_REQUEST_NULL if none, and when it completes
+    // (an MPI_Wtime() value, -1 for no deadline).
+    MPI_Request request;
+    double deadline;
+
+    bool woken;
+    bool stop;
+} wake_timer_t;
+
+wake_timer_t *create_wake_timer();
+void destroy_wake_timer(wake_timer_t *timer);
+void start_wake_timer(wake_timer_t *timer, double deadline, MPI_Request *request);
+void finish_wake_timer(wake_timer_t *timer, MPI_Request *request);
+void wake_timer(wake_timer_t *timer);
+
+#endif